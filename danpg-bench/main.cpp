@@ -0,0 +1,329 @@
+//
+//  main.cpp
+//  danpg-bench
+//
+//  Created by Daniel Burke on 19/10/2026.
+//
+
+#include <iostream>
+#include <sstream>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <Foundation/Foundation.hpp>
+#include <Metal/Metal.hpp>
+#include <QuartzCore/QuartzCore.hpp>
+
+#include "allocator.hpp"
+#include "jpeg.hpp"
+#include "synthjpeg.hpp"
+
+namespace {
+
+struct Layout {
+    std::string name;
+    uint8_t h;
+    uint8_t v;
+};
+
+struct Options {
+    std::vector<double> megapixels = {0.3, 1, 4, 12, 24, 50, 100};
+    std::vector<Layout> layouts = {{"444", 1, 1}, {"422", 2, 1}, {"420", 2, 2}};
+    std::vector<int> qualities = {50, 75, 95};
+    std::vector<uint16_t> restartIntervals = {0, 16};
+    size_t maxThreads = std::max<unsigned>(1, std::thread::hardware_concurrency());
+    size_t repeat = 3;
+    size_t pipelineThreads = 0;
+    bool cpu = false;
+    bool unstuff = false;
+    bool multiSymbol = false;
+    bool json = false;
+};
+
+//one thread count for one configuration
+struct Run {
+    size_t threads = 0;
+    size_t decoded = 0;
+    size_t failed = 0;
+    double wallSeconds = 0;
+    double megapixelsPerSecond = 0;
+    double efficiency = 0; //against the one thread run, 1 is perfect scaling
+    size_t peakImageBytes = 0; //the most one decode had live
+    size_t peakTotalBytes = 0; //the most every decode had live at once
+};
+
+void printUsage() {
+    std::cout << "usage: danpg-bench [options]\n"
+              << "  --sizes LIST      megapixels of each image, 4:3 (default 0.3,1,4,12,24,50,100)\n"
+              << "  --layouts LIST    any of 444, 422, 420 and grey (default 444,422,420)\n"
+              << "  --qualities LIST  encoder quality, 1 to 100 (default 50,75,95)\n"
+              << "  --dri LIST        MCUs between restart markers, 0 for none (default 0,16)\n"
+              << "  --threads N       run 1, 2, 4 ... up to N threads (default all cores)\n"
+              << "  --repeat N        decodes per thread in each run (default 3)\n"
+              << "  --cpu             decode without metal\n"
+              << "  --pipeline N      cpu transform threads per image (default 0)\n"
+              << "  --unstuff         remove byte stuffing before entropy decoding\n"
+              << "  --multisymbol     decode short ac codes several at a time\n"
+              << "  --json            print the report as json" << std::endl;
+}
+
+template<typename T, typename Parse>
+std::vector<T> parseList(const std::string& list, Parse parse) {
+    std::vector<T> values;
+    std::stringstream stream(list);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        if (!item.empty()) {
+            values.push_back(parse(item));
+        }
+    }
+    if (values.empty()) {
+        throw std::runtime_error("empty list " + list);
+    }
+    return values;
+}
+
+Layout parseLayout(const std::string& name) {
+    if (name == "444") {
+        return {name, 1, 1};
+    } else if (name == "422") {
+        return {name, 2, 1};
+    } else if (name == "420") {
+        return {name, 2, 2};
+    } else if (name == "grey") {
+        return {name, 0, 0};
+    }
+    throw std::runtime_error("unknown layout " + name);
+}
+
+bool parseOptions(int argc, const char* argv[], Options& options) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        auto nextValue = [&]() -> std::string {
+            if (i + 1 >= argc) {
+                throw std::runtime_error("missing value for " + arg);
+            }
+            return argv[++i];
+        };
+
+        if (arg == "--sizes") {
+            options.megapixels = parseList<double>(nextValue(), [](const std::string& s) { return std::stod(s); });
+        } else if (arg == "--layouts") {
+            options.layouts = parseList<Layout>(nextValue(), parseLayout);
+        } else if (arg == "--qualities") {
+            options.qualities = parseList<int>(nextValue(), [](const std::string& s) { return std::stoi(s); });
+        } else if (arg == "--dri") {
+            options.restartIntervals = parseList<uint16_t>(nextValue(), [](const std::string& s) { return static_cast<uint16_t>(std::stoul(s)); });
+        } else if (arg == "--threads") {
+            options.maxThreads = std::max<size_t>(1, std::stoul(nextValue()));
+        } else if (arg == "--repeat") {
+            options.repeat = std::max<size_t>(1, std::stoul(nextValue()));
+        } else if (arg == "--pipeline") {
+            options.pipelineThreads = std::stoul(nextValue());
+        } else if (arg == "--cpu") {
+            options.cpu = true;
+        } else if (arg == "--unstuff") {
+            options.unstuff = true;
+        } else if (arg == "--multisymbol") {
+            options.multiSymbol = true;
+        } else if (arg == "--json") {
+            options.json = true;
+        } else {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+//doubling from one, ending on maxThreads even when it isn't a power of two
+std::vector<size_t> threadCounts(size_t maxThreads) {
+    std::vector<size_t> counts;
+    for (size_t threads = 1; threads < maxThreads; threads *= 2) {
+        counts.push_back(threads);
+    }
+    counts.push_back(maxThreads);
+    return counts;
+}
+
+//threads decoders each decode the image repeat times, all at once
+Run measure(std::vector<uint8_t>& data, size_t threads, size_t repeat, const image::DecodeOptions& decodeOptions) {
+    Run run;
+    run.threads = threads;
+
+    //each decode counts against its own allocator, and through it the shared one
+    image::AccountingAllocator total;
+    image::Allocator& upstream = total;
+    std::atomic<size_t> decoded = 0;
+    std::atomic<size_t> failed = 0;
+    std::atomic<size_t> pixels = 0;
+    std::atomic<size_t> peakImageBytes = 0;
+
+    auto worker = [&]() {
+        for (size_t i = 0; i < repeat; i++) {
+            auto pool = NS::TransferPtr(NS::AutoreleasePool::alloc()->init());
+            image::AccountingAllocator allocator(upstream);
+            auto options = decodeOptions;
+            options._allocator = &allocator;
+            try {
+                auto image = image::decodeImage(data, options);
+                if (!image || image._error != DecodeError::None) {
+                    failed++;
+                    continue;
+                }
+                decoded++;
+                pixels += image._width * image._height;
+            } catch (std::exception& e) {
+                std::cerr << e.what() << std::endl;
+                failed++;
+                continue;
+            }
+
+            size_t peak = allocator.peakBytes();
+            size_t seen = peakImageBytes.load();
+            while (peak > seen && !peakImageBytes.compare_exchange_weak(seen, peak)) {}
+        }
+    };
+
+    auto start = std::chrono::high_resolution_clock::now();
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < threads; i++) {
+        workers.emplace_back(worker);
+    }
+    for (auto& thread : workers) {
+        thread.join();
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+
+    run.decoded = decoded;
+    run.failed = failed;
+    run.wallSeconds = std::chrono::duration<double>(end - start).count();
+    run.megapixelsPerSecond = pixels / 1e6 / run.wallSeconds;
+    run.peakImageBytes = peakImageBytes;
+    run.peakTotalBytes = total.peakBytes();
+    return run;
+}
+
+}
+
+int main(int argc, const char * argv[]) {
+    Options options;
+    try {
+        if (!parseOptions(argc, argv, options)) {
+            printUsage();
+            return 1;
+        }
+    } catch (std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        printUsage();
+        return 1;
+    }
+
+    NS::SharedPtr<NS::AutoreleasePool> _pool;
+    NS::SharedPtr<MTL::Device> _metalDevice;
+    _pool = NS::TransferPtr(NS::AutoreleasePool::alloc()->init());
+    if (!options.cpu) {
+        _metalDevice = NS::TransferPtr(MTL::CreateSystemDefaultDevice());
+    }
+
+    image::DecodeOptions decodeOptions;
+    decodeOptions._metalDevice = _metalDevice.get();
+    decodeOptions._pipelineThreads = options.pipelineThreads;
+    decodeOptions._unstuffScan = options.unstuff;
+    decodeOptions._multiSymbolAC = options.multiSymbol;
+
+    auto counts = threadCounts(options.maxThreads);
+    const char* backend = _metalDevice ? "metal" : "cpu";
+    bool allDecoded = true;
+
+    if (options.json) {
+        std::cout << "{\"backend\": \"" << backend << "\", \"repeat\": " << options.repeat << ", \"configurations\": [";
+    } else {
+        std::cout << "Backend " << backend << ", " << options.repeat << " decodes per thread" << std::endl;
+        std::cout << "size(MP) layout quality dri threads MP/s efficiency peak/image(MB) peak/run(MB)" << std::endl;
+    }
+
+    const char* separator = "";
+    for (double megapixels : options.megapixels) {
+        //4:3, so the largest sizes still fit in 16 bit dimensions
+        size_t width = std::max<size_t>(1, std::lround(std::sqrt(megapixels * 1e6 * 4 / 3)));
+        size_t height = std::max<size_t>(1, std::lround(width * 0.75));
+
+        for (auto& layout : options.layouts) {
+            for (int quality : options.qualities) {
+                for (uint16_t restartInterval : options.restartIntervals) {
+                    image::SyntheticJpeg synth;
+                    synth._width = width;
+                    synth._height = height;
+                    synth._greyscale = layout.h == 0;
+                    if (!synth._greyscale) {
+                        synth._h = layout.h;
+                        synth._v = layout.v;
+                    }
+                    synth._quality = quality;
+                    synth._restartInterval = restartInterval;
+
+                    std::vector<uint8_t> data;
+                    try {
+                        data = synth.encode();
+                    } catch (std::exception& e) {
+                        std::cerr << megapixels << "MP: " << e.what() << std::endl;
+                        allDecoded = false;
+                        continue;
+                    }
+
+                    //first touches, metal pipeline creation and the like aren't what's measured
+                    measure(data, 1, 1, decodeOptions);
+                    std::vector<Run> runs;
+                    for (size_t threads : counts) {
+                        runs.push_back(measure(data, threads, options.repeat, decodeOptions));
+                        runs.back().efficiency = runs.front().megapixelsPerSecond > 0 ? runs.back().megapixelsPerSecond / (threads * runs.front().megapixelsPerSecond) : 0;
+                    }
+
+                    if (options.json) {
+                        std::cout << separator << "{\"width\": " << width << ", \"height\": " << height
+                                  << ", \"layout\": \"" << layout.name << "\", \"quality\": " << quality
+                                  << ", \"restart_interval\": " << restartInterval
+                                  << ", \"compressed_bytes\": " << data.size() << ", \"runs\": [";
+                        const char* runSeparator = "";
+                        for (auto& run : runs) {
+                            std::cout << runSeparator << "{\"threads\": " << run.threads
+                                      << ", \"decoded\": " << run.decoded
+                                      << ", \"failed\": " << run.failed
+                                      << ", \"wall_seconds\": " << run.wallSeconds
+                                      << ", \"megapixels_per_second\": " << run.megapixelsPerSecond
+                                      << ", \"efficiency\": " << run.efficiency
+                                      << ", \"peak_image_megabytes\": " << run.peakImageBytes / 1e6
+                                      << ", \"peak_run_megabytes\": " << run.peakTotalBytes / 1e6 << "}";
+                            runSeparator = ", ";
+                        }
+                        std::cout << "]}" << std::flush;
+                        separator = ", ";
+                    } else {
+                        for (auto& run : runs) {
+                            std::cout << megapixels << " " << layout.name << " " << quality << " " << restartInterval << " "
+                                      << run.threads << " " << run.megapixelsPerSecond << " " << run.efficiency * 100 << "% "
+                                      << run.peakImageBytes / 1e6 << " " << run.peakTotalBytes / 1e6
+                                      << (run.failed ? " (" + std::to_string(run.failed) + " failed)" : "") << std::endl;
+                        }
+                    }
+
+                    for (auto& run : runs) {
+                        allDecoded = allDecoded && run.failed == 0;
+                    }
+                }
+            }
+        }
+    }
+
+    if (options.json) {
+        std::cout << "]}" << std::endl;
+    }
+
+    return allDecoded ? 0 : 2;
+}
@@ -0,0 +1,184 @@
+//
+//  allocator_test.cpp
+//  danpg-tests
+//
+//  Created by Daniel Burke on 19/10/2026.
+//
+
+#include <gtest/gtest.h>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+#include "allocator.hpp"
+#include "jpeg.hpp"
+#include "mjpeg.hpp"
+#include "testframes.hpp"
+
+using namespace image;
+
+namespace {
+
+std::atomic<size_t> heapAllocations = 0;
+
+}
+
+//counts every heap allocation in the test binary
+void* operator new(size_t bytes) {
+    heapAllocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* memory = std::malloc(bytes ? bytes : 1)) {
+        return memory;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* memory) noexcept {
+    std::free(memory);
+}
+
+void operator delete(void* memory, size_t) noexcept {
+    std::free(memory);
+}
+
+namespace {
+
+//4:2:0 frame of 64x64 without DHT, every block coded as zero with the
+//Annex K tables so the image is mid grey
+std::vector<uint8_t> greyFrame420() {
+    TestFrame frame;
+    frame._width = 64;
+    frame._height = 64;
+    frame._h = 2;
+    frame._v = 2;
+    frame._huffmanTables = false;
+
+    // four luma blocks of b00 b1010 then chroma b00 b00 twice, per MCU
+    std::vector<uint8_t> scan;
+    for (size_t mcu = 0; mcu < 16; mcu++) {
+        scan.insert(scan.end(), {0x28, 0xA2, 0x8A, 0x00});
+    }
+    return frame.frame(scan);
+}
+
+TEST(AllocatorTest, AccountingTracksLiveAndPeak) {
+    AccountingAllocator allocator;
+
+    void* a = allocator.allocate(4096, 64);
+    void* b = allocator.allocate(128, 64);
+    EXPECT_EQ(allocator.liveBytes(), 4224);
+    EXPECT_EQ(allocator.allocations(), 2);
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(a) % 64, 0);
+
+    allocator.deallocate(a, 4096);
+    EXPECT_EQ(allocator.liveBytes(), 128);
+    EXPECT_EQ(allocator.peakBytes(), 4224);
+
+    allocator.resetPeak();
+    EXPECT_EQ(allocator.peakBytes(), 128);
+
+    allocator.deallocate(b, 128);
+    EXPECT_EQ(allocator.liveBytes(), 0);
+}
+
+TEST(AllocatorTest, DecodeBuffersComeFromAllocator) {
+    auto frame = greyFrame420();
+    AccountingAllocator allocator;
+
+    {
+        MjpegDecoder decoder(nullptr, 0, Jpeg::OutputMode::Colour, allocator);
+        decoder.decodeFrame(frame);
+
+        EXPECT_EQ(decoder.frame()._scanError, DecodeError::None);
+        EXPECT_EQ(decoder.frame()._image[0].r, 128);
+        //three planes and the image
+        EXPECT_EQ(allocator.allocations(), 4);
+        EXPECT_GE(allocator.peakBytes(), 64 * 64 * sizeof(Colour));
+        EXPECT_EQ(allocator.liveBytes(), allocator.peakBytes());
+    }
+
+    EXPECT_EQ(allocator.liveBytes(), 0);
+}
+
+TEST(AllocatorTest, NoAllocationsAfterWarmUp) {
+    auto frame = greyFrame420();
+    AccountingAllocator allocator;
+    MjpegDecoder decoder(nullptr, 0, Jpeg::OutputMode::Colour, allocator);
+
+    //first frames build the tables, planes and image
+    for (size_t i = 0; i < 2; i++) {
+        decoder.decodeFrame(frame);
+    }
+
+    size_t bufferAllocations = allocator.allocations();
+    size_t heapBefore = heapAllocations.load();
+    for (size_t i = 0; i < 8; i++) {
+        decoder.decodeFrame(frame);
+        EXPECT_EQ(decoder.frame()._scanError, DecodeError::None);
+    }
+
+    EXPECT_EQ(heapAllocations.load() - heapBefore, 0);
+    EXPECT_EQ(allocator.allocations(), bufferAllocations);
+    EXPECT_EQ(decoder.frame()._image[64 * 64 - 1].b, 128);
+}
+
+
+TEST(AllocatorTest, ArenaBumpsAndResets) {
+    ArenaAllocator arena(1 << 16);
+
+    auto a = static_cast<uint8_t*>(arena.allocate(100, 64));
+    auto b = static_cast<uint8_t*>(arena.allocate(64, 64));
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(b) % 64, 0);
+    EXPECT_EQ(b - a, 128);
+
+    //too big for the chunk, gets its own
+    arena.allocate(1 << 17, 64);
+    EXPECT_EQ(arena.capacity(), (1 << 16) + (1 << 17));
+
+    arena.deallocate(a, 100);
+    arena.reset();
+    EXPECT_EQ(arena.allocate(100, 64), a);
+    EXPECT_EQ(arena.capacity(), (1 << 16) + (1 << 17));
+}
+
+TEST(AllocatorTest, HugePagePoolReusesRegions) {
+    HugePagePool pool(false);
+
+    size_t bytes = 3 << 20;
+    void* a = pool.allocate(bytes, 64);
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(a) % (2 << 20), 0);
+    EXPECT_EQ(pool.mappedBytes(), 4 << 20);
+
+    //a region in use isn't handed out twice
+    void* b = pool.allocate(bytes, 64);
+    EXPECT_NE(a, b);
+
+    pool.deallocate(a, bytes);
+    EXPECT_EQ(pool.allocate(bytes - 4096, 64), a);
+
+    pool.deallocate(b, bytes);
+    pool.trim();
+    EXPECT_EQ(pool.mappedBytes(), 4 << 20);
+    pool.deallocate(a, bytes);
+}
+
+TEST(AllocatorTest, DecodeIntoArenaOverPool) {
+    auto frame = greyFrame420();
+    HugePagePool pool;
+    ArenaAllocator arena(1 << 20, pool);
+
+    for (size_t i = 0; i < 3; i++) {
+        {
+            MjpegDecoder decoder(nullptr, 0, Jpeg::OutputMode::Colour, arena);
+            decoder.decodeFrame(frame);
+            EXPECT_EQ(decoder.frame()._scanError, DecodeError::None);
+            EXPECT_EQ(decoder.frame()._image[0].g, 128);
+        }
+        arena.reset();
+    }
+
+    EXPECT_EQ(arena.capacity(), 1 << 20);
+    EXPECT_EQ(pool.mappedBytes(), 1 << 20);
+}
+
+}
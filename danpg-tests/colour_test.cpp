@@ -7,6 +7,7 @@
 
 #include <gtest/gtest.h>
 #include <string>
+#include <vector>
 
 #include "colour.hpp"
 
@@ -20,6 +21,116 @@ TEST(ColourTest, YCbCrToRGB) {
     EXPECT_EQ(conversion, Colour({98, 73, 54}));
 }
 
+std::vector<Colour> colourSweep() {
+    std::vector<Colour> colours;
+    for (int y = -128; y < 128; y += 5) {
+        for (int cb = -128; cb < 128; cb += 3) {
+            for (int cr = -128; cr < 128; cr += 3) {
+                colours.push_back({y, cb, cr});
+            }
+        }
+    }
+    return colours;
+}
+
+TEST(ColourTest, FixedPointWithinOneOfFloat) {
+    auto colours = colourSweep();
+    auto converted = colours;
+    ycbcrToRGBFixedPoint(converted.data(), converted.size(), ColourKernel::Portable);
+
+    for (size_t i = 0; i < colours.size(); i++) {
+        auto expected = ycbcrToRGB(colours[i]);
+        EXPECT_NEAR(converted[i].r, expected.r, 1);
+        EXPECT_NEAR(converted[i].g, expected.g, 1);
+        EXPECT_NEAR(converted[i].b, expected.b, 1);
+        EXPECT_EQ(converted[i].padding, 0);
+    }
+}
+
+TEST(ColourTest, FixedPointKernelsMatchPortable) {
+    auto colours = colourSweep();
+    //out of range idct output has to saturate the same way everywhere
+    colours.push_back({2000, -3000, 5000});
+    colours.push_back({-70000, 70000, -70000});
+    //leave a tail that is not a whole vector
+    colours.push_back({1, 2, 3});
+
+    auto expected = colours;
+    ycbcrToRGBFixedPoint(expected.data(), expected.size(), ColourKernel::Portable);
+
+    for (auto kernel : {ColourKernel::SSE2, ColourKernel::AVX2, ColourKernel::NEON}) {
+        if (!colourKernelSupported(kernel)) {
+            continue;
+        }
+
+        auto converted = colours;
+        ycbcrToRGBFixedPoint(converted.data(), converted.size(), kernel);
+        for (size_t i = 0; i < colours.size(); i++) {
+            EXPECT_EQ(converted[i], expected[i]) << "kernel " << static_cast<int>(kernel) << " pixel " << i;
+            EXPECT_EQ(converted[i].padding, 0);
+        }
+    }
+}
+
+TEST(ColourTest, PackPixels) {
+    std::vector<Colour> rgb = {{1, 2, 3}, {250, 251, 252}};
+    
+    std::vector<uint8_t> out(8, 0);
+    packPixels(rgb.data(), rgb.size(), PixelFormat::RGB8, out.data());
+    EXPECT_EQ(out, std::vector<uint8_t>({1, 2, 3, 250, 251, 252, 0, 0}));
+    
+    packPixels(rgb.data(), rgb.size(), PixelFormat::RGBA8, out.data());
+    EXPECT_EQ(out, std::vector<uint8_t>({1, 2, 3, 255, 250, 251, 252, 255}));
+    
+    packPixels(rgb.data(), rgb.size(), PixelFormat::BGRA8, out.data());
+    EXPECT_EQ(out, std::vector<uint8_t>({3, 2, 1, 255, 252, 251, 250, 255}));
+    
+    EXPECT_EQ(bytesPerPixel(PixelFormat::RGB8), 3);
+    EXPECT_EQ(bytesPerPixel(PixelFormat::Grey8), 1);
+}
+
+TEST(ColourTest, FloatToHalf) {
+    EXPECT_EQ(floatToHalf(0.f), 0x0000);
+    EXPECT_EQ(floatToHalf(1.f), 0x3c00);
+    EXPECT_EQ(floatToHalf(-2.f), 0xc000);
+    EXPECT_EQ(floatToHalf(0.1f), 0x2e66);
+    EXPECT_EQ(floatToHalf(65504.f), 0x7bff);
+    EXPECT_EQ(floatToHalf(1e6f), 0x7c00);
+    EXPECT_EQ(floatToHalf(1e-7f), 0x0002);
+}
+
+TEST(ColourTest, TensorWriterLayouts) {
+    //two pixels wide, one line, written into the second slot of a batch
+    std::vector<Colour> rgb = {{0, 51, 255}, {255, 102, 0}};
+    
+    std::vector<float> nchw(2 * 3 * 2, -1.f);
+    TensorOutput output;
+    output._data = nchw.data();
+    output._batchIndex = 1;
+    output._mean = {0.f, 0.2f, 0.f};
+    output._std = {1.f, 0.5f, 1.f};
+    TensorWriter(output, 2, 1).writeLine(rgb.data(), 0);
+    std::vector<float> expectedNCHW = {-1.f, -1.f, -1.f, -1.f, -1.f, -1.f, 0.f, 1.f, 0.f, 0.4f, 1.f, 0.f};
+    for (size_t i = 0; i < nchw.size(); i++) {
+        EXPECT_NEAR(nchw[i], expectedNCHW[i], 1e-6f);
+    }
+    
+    std::vector<int8_t> nhwc(6, 0);
+    output._data = nhwc.data();
+    output._batchIndex = 0;
+    output._layout = TensorLayout::NHWC;
+    output._type = TensorType::Int8;
+    output._int8Scale = 1.f / 100.f;
+    TensorWriter(output, 2, 1).writeLine(rgb.data(), 0);
+    EXPECT_EQ(nhwc, std::vector<int8_t>({0, 0, 100, 100, 40, 0}));
+    
+    std::vector<uint16_t> half(6, 0);
+    output._data = half.data();
+    output._type = TensorType::Float16;
+    TensorWriter(output, 2, 1).writeLine(rgb.data(), 0);
+    EXPECT_EQ(half, std::vector<uint16_t>({0x0000, 0x0000, 0x3c00, 0x3c00, floatToHalf(0.4f), 0x0000}));
+}
+
 TEST(ColourTest, IndexTest) {
     Colour ycbcr;
     ycbcr.setIndexColour(0, 11);
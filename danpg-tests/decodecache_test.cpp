@@ -0,0 +1,148 @@
+//
+//  decodecache_test.cpp
+//  danpg-tests
+//
+//  Created by Daniel Burke on 19/10/2026.
+//
+
+#include <gtest/gtest.h>
+#include <set>
+#include <thread>
+#include <vector>
+
+#include "decodecache.hpp"
+#include "testframes.hpp"
+
+using namespace image;
+
+namespace {
+
+//greyscale 8x8, one block of a four bit dc difference and an eob. 8 to 15
+//is how far above mid grey it is.
+std::vector<uint8_t> greyBlock(uint8_t dc) {
+    //b101 for a four bit difference, the difference, then b1010 and padding
+    return TestFrame().frame({static_cast<uint8_t>(0xA0 | (dc << 1) | 1), 0x5F});
+}
+
+TEST(DecodeCacheTest, HashBytes) {
+    std::vector<uint8_t> data(100);
+    for (size_t i = 0; i < data.size(); i++) {
+        data[i] = static_cast<uint8_t>(i * 7);
+    }
+    
+    //every length through the tail handling and the lanes hashes differently
+    std::set<uint64_t> hashes;
+    for (size_t length = 0; length <= data.size(); length++) {
+        hashes.insert(hashBytes(std::span(data).first(length)));
+    }
+    EXPECT_EQ(hashes.size(), data.size() + 1);
+    
+    EXPECT_EQ(hashBytes(data), hashBytes(data));
+    EXPECT_NE(hashBytes(data), hashBytes(data, 1));
+    auto hash = hashBytes(data);
+    data[63] ^= 1;
+    EXPECT_NE(hashBytes(data), hash);
+}
+
+TEST(DecodeCacheTest, HitsSkipTheDecode) {
+    auto data = greyBlock(8);
+    DecodeCache cache;
+    
+    auto first = cache.decode(data);
+    ASSERT_TRUE(*first);
+    EXPECT_EQ(first->colours()[0].r, 136);
+    
+    auto second = cache.decode(data);
+    EXPECT_EQ(second, first);
+    EXPECT_EQ(cache.hits(), 1);
+    EXPECT_EQ(cache.misses(), 1);
+    EXPECT_EQ(cache.cachedBytes(), 8 * 8 * sizeof(Colour));
+    
+    //luma is different pixels from the same bytes
+    DecodeOptions luma;
+    luma._outputMode = Jpeg::OutputMode::Luma;
+    auto grey = cache.decode(data, luma);
+    EXPECT_NE(grey, first);
+    EXPECT_EQ(grey->luma()[0], 136);
+    EXPECT_EQ(cache.misses(), 2);
+}
+
+TEST(DecodeCacheTest, EvictsLeastRecentlyUsed) {
+    auto a = greyBlock(9);
+    auto b = greyBlock(10);
+    auto c = greyBlock(11);
+    //room for two colour images
+    DecodeCache cache(2 * 8 * 8 * sizeof(Colour));
+    
+    auto held = cache.decode(a);
+    cache.decode(b);
+    cache.decode(a);
+    cache.decode(c);
+    EXPECT_EQ(cache.misses(), 3);
+    
+    //b went, a was used more recently
+    cache.decode(a);
+    EXPECT_EQ(cache.misses(), 3);
+    cache.decode(b);
+    EXPECT_EQ(cache.misses(), 4);
+    EXPECT_EQ(cache.cachedBytes(), 2 * 8 * 8 * sizeof(Colour));
+    
+    //still usable after the cache let go of it
+    cache.clear();
+    EXPECT_EQ(cache.cachedBytes(), 0);
+    EXPECT_EQ(held->colours()[63].g, 137);
+}
+
+TEST(DecodeCacheTest, ConcurrentRequestsDecodeOnce) {
+    auto data = greyBlock(12);
+    DecodeCache cache;
+    
+    std::vector<std::shared_ptr<const DecodedImage>> images(8);
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < images.size(); i++) {
+        threads.emplace_back([&, i]() { images[i] = cache.decode(data); });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    
+    EXPECT_EQ(cache.misses(), 1);
+    EXPECT_EQ(cache.hits() + cache.waits(), images.size() - 1);
+    for (auto& image : images) {
+        EXPECT_EQ(image, images[0]);
+    }
+}
+
+TEST(DecodeCacheTest, FailuresArentCached) {
+    //16 bit quantisation tables aren't supported
+    std::vector<uint8_t> data = {0xFF, 0xD8, 0xFF, 0xDB, 0x00, 0x83, 0x10};
+    data.insert(data.end(), 128, 0x00);
+    data.insert(data.end(), {0xFF, 0xD9});
+    DecodeCache cache;
+    
+    EXPECT_THROW(cache.decode(data), std::logic_error);
+    EXPECT_THROW(cache.decode(data), std::logic_error);
+    EXPECT_EQ(cache.misses(), 2);
+    EXPECT_EQ(cache.cachedBytes(), 0);
+    
+    //four blocks high with only the first in the scan, the rest are kept
+    //but the image is incomplete
+    TestFrame frame;
+    frame._height = 32;
+    auto truncated = frame.frame({0x2B});
+    auto partial = cache.decode(truncated);
+    ASSERT_TRUE(*partial);
+    EXPECT_EQ(partial->_error, DecodeError::OutOfData);
+    EXPECT_NE(cache.decode(truncated), partial);
+    EXPECT_EQ(cache.misses(), 4);
+    
+    //no frame, so no image
+    std::vector<uint8_t> empty = {0xFF, 0xD8, 0xFF, 0xD9};
+    EXPECT_FALSE(*cache.decode(empty));
+    EXPECT_FALSE(*cache.decode(empty));
+    EXPECT_EQ(cache.misses(), 6);
+    EXPECT_EQ(cache.hits(), 0);
+    EXPECT_EQ(cache.cachedBytes(), 0);
+}
+
+}
@@ -49,6 +49,43 @@ TEST(HuffmanTable, CalculateData) {
     EXPECT_EQ(table._huffcode, huffcodeExpected);
 }
 
+TEST(HuffmanTable, MultiSymbol) {
+    //00 0x01, 01 EOB, 100 ZRL, 101 0x11
+    std::vector<uint8_t> data = {0, 2, 2, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x01, 0x00, 0xF0, 0x11};
+    auto table = HuffmanTable::build(data);
+    EXPECT_TRUE(table._multiSymbol.empty());
+    table.buildMultiSymbol();
+    ASSERT_EQ(table._multiSymbol.size(), 1 << HuffmanTable::multiSymbolBits);
+    
+    //00 1, 01, stops at the eob
+    auto& coefficientThenEOB = table._multiSymbol[0b00101000000];
+    EXPECT_EQ(coefficientThenEOB._count, 2);
+    EXPECT_EQ(coefficientThenEOB._bits[0], 3);
+    EXPECT_EQ(coefficientThenEOB._run[0], 0);
+    EXPECT_EQ(coefficientThenEOB._value[0], 1);
+    EXPECT_EQ(coefficientThenEOB._bits[1], 5);
+    EXPECT_EQ(coefficientThenEOB._run[1], HuffmanTable::multiSymbolEOB);
+    
+    //100, 100, 101 0
+    auto& zeroRuns = table._multiSymbol[0b10010010100];
+    EXPECT_EQ(zeroRuns._count, 3);
+    EXPECT_EQ(zeroRuns._run[0], 15);
+    EXPECT_EQ(zeroRuns._value[0], 0);
+    EXPECT_EQ(zeroRuns._bits[1], 6);
+    EXPECT_EQ(zeroRuns._run[2], 1);
+    EXPECT_EQ(zeroRuns._value[2], -1);
+    EXPECT_EQ(zeroRuns._bits[2], 10);
+    
+    //101 1, 101 1, 00 1 uses the whole window
+    auto& fullWindow = table._multiSymbol[0b10111011001];
+    EXPECT_EQ(fullWindow._count, 3);
+    EXPECT_EQ(fullWindow._bits[2], 11);
+    
+    //the third 101 fits but its magnitude bit doesn't. no code starts 11
+    EXPECT_EQ(table._multiSymbol[0b10111011101]._count, 2);
+    EXPECT_EQ(table._multiSymbol[0b11000000000]._count, 0);
+}
+
 class HuffmanDecoderTest : public ::testing::Test {
 protected:
     void SetUp() override {
@@ -249,10 +286,23 @@ TEST_F(HuffmanDecoderTest, DecodeMarkerSegment) {
 
     decoder.setData(encoded);
     EXPECT_FALSE(decoder.markerEncountered());
-    EXPECT_THROW(decoder.nextXBits(8), std::runtime_error);
+    EXPECT_EQ(decoder.nextXBits(8), 0);
+    EXPECT_EQ(decoder.error(), DecodeError::OutOfData);
     EXPECT_TRUE(decoder.markerEncountered());
 }
 
+TEST_F(HuffmanDecoderTest, ResetSkipsPaddingBeforeRestart) {
+    std::vector<uint8_t> encoded = {0xA7, 0xFF, 0xD0, 0x5A};
+
+    decoder.setData(encoded);
+    //the rest of the first byte is padding and the marker hasn't been read
+    EXPECT_EQ(decoder.nextXBits(4), 0x0A);
+    EXPECT_FALSE(decoder.markerEncountered());
+    decoder.reset();
+    EXPECT_EQ(decoder.nextXBits(8), 0x5A);
+    EXPECT_EQ(decoder.error(), DecodeError::None);
+}
+
 TEST_F(HuffmanDecoderTest, PeekAndReadMarkerSegment) {
     std::vector<uint8_t> encoded = {0xFF, 0xD0};
 
@@ -260,7 +310,8 @@ TEST_F(HuffmanDecoderTest, PeekAndReadMarkerSegment) {
     EXPECT_FALSE(decoder.markerEncountered());
     EXPECT_NO_THROW(decoder.peakXBits(16));
     EXPECT_TRUE(decoder.markerEncountered());
-    EXPECT_THROW(decoder.nextXBits(16), std::runtime_error);
+    EXPECT_EQ(decoder.nextXBits(16), 0);
+    EXPECT_EQ(decoder.error(), DecodeError::OutOfData);
     EXPECT_TRUE(decoder.markerEncountered());
 }
 
@@ -290,7 +341,8 @@ TEST_F(HuffmanDecoderTest, PeekAndReadAheadofMarkerSegment2) {
     EXPECT_TRUE(decoder.markerEncountered());
     EXPECT_EQ(decoder.nextXBits(4), 0x00);
     EXPECT_TRUE(decoder.markerEncountered());
-    EXPECT_THROW(decoder.nextXBits(16), std::runtime_error);
+    EXPECT_EQ(decoder.nextXBits(16), 0);
+    EXPECT_EQ(decoder.error(), DecodeError::OutOfData);
 }
 
 TEST_F(HuffmanDecoderTest, NotEnoughBytesErrorDueToNoBytes) {
@@ -298,7 +350,8 @@ TEST_F(HuffmanDecoderTest, NotEnoughBytesErrorDueToNoBytes) {
 
     decoder.setData(encoded);
     
-    EXPECT_THROW(decoder.nextXBits(9), std::runtime_error);
+    EXPECT_EQ(decoder.nextXBits(9), 0);
+    EXPECT_EQ(decoder.error(), DecodeError::OutOfData);
 }
 
 TEST_F(HuffmanDecoderTest, NotEnoughBytesErrorDueToMarkerSegment) {
@@ -306,7 +359,8 @@ TEST_F(HuffmanDecoderTest, NotEnoughBytesErrorDueToMarkerSegment) {
 
     decoder.setData(encoded);
     
-    EXPECT_THROW(decoder.nextXBits(9), std::runtime_error);
+    EXPECT_EQ(decoder.nextXBits(9), 0);
+    EXPECT_EQ(decoder.error(), DecodeError::OutOfData);
 }
 
 TEST_F(HuffmanDecoderTest, Decode3bitSkip3Then3bit) {
@@ -390,7 +444,8 @@ TEST_F(HuffmanDecoderTest, Peak9bitFailRead) {
     auto byte = decoder.peakXBits(9);
     EXPECT_EQ(byte, 0x1e0);
     
-    EXPECT_THROW(decoder.nextXBits(9), std::runtime_error);
+    EXPECT_EQ(decoder.nextXBits(9), 0);
+    EXPECT_EQ(decoder.error(), DecodeError::OutOfData);
 }
 
 TEST_F(HuffmanDecoderTest, Peak16bitFailRead) {
@@ -400,7 +455,8 @@ TEST_F(HuffmanDecoderTest, Peak16bitFailRead) {
     auto byte = decoder.peakXBits(16);
     EXPECT_EQ(byte, 0xF000);
     
-    EXPECT_THROW(decoder.nextXBits(16), std::runtime_error);
+    EXPECT_EQ(decoder.nextXBits(16), 0);
+    EXPECT_EQ(decoder.error(), DecodeError::OutOfData);
 }
 
 TEST_F(HuffmanDecoderTest, Peak16bitRead4bit) {
@@ -419,7 +475,8 @@ TEST_F(HuffmanDecoderTest, Peak16bitRead4bit) {
     byte = decoder.nextXBits(4);
     EXPECT_EQ(byte, 0x00);
     
-    EXPECT_THROW(decoder.nextXBits(8), std::runtime_error);
+    EXPECT_EQ(decoder.nextXBits(8), 0);
+    EXPECT_EQ(decoder.error(), DecodeError::OutOfData);
 }
 
 TEST_F(HuffmanDecoderTest, Peak16bitRead4and4) {
@@ -446,3 +503,96 @@ TEST_F(HuffmanDecoderTest, Peak16bitRead4and4) {
 }
 
 }
+
+TEST_F(HuffmanDecoderTest, HuffmanErrorIsSticky) {
+    // b1111 1111 1 has no code in the table
+    std::vector<uint8_t> encoded = {0xFF, 0x00, 0xFF, 0x00, 0x00};
+
+    decoder.setData(encoded);
+    EXPECT_EQ(decoder.error(), DecodeError::None);
+    EXPECT_EQ(decoder.nextHuffmanByte(), 0x00);
+    EXPECT_EQ(decoder.error(), DecodeError::HuffmanCode);
+    
+    decoder.fail(DecodeError::Syntax);
+    decoder.reset();
+    EXPECT_EQ(decoder.error(), DecodeError::HuffmanCode);
+}
+
+TEST(UnstuffScan, RemovesStuffingAndRecordsRestarts) {
+    // stuffed FF, fill byte before RST0, then EOI ends the scan
+    std::vector<uint8_t> scan = {0x12, 0xFF, 0x00, 0x34, 0xFF, 0xFF, 0xD0, 0x56, 0xFF, 0xD9, 0x78};
+    auto unstuffed = unstuffScan(scan);
+    
+    std::vector<uint8_t> dataExpected = {0x12, 0xFF, 0x34, 0x56};
+    EXPECT_EQ(unstuffed._data, dataExpected);
+    
+    std::vector<size_t> restartsExpected = {3};
+    EXPECT_EQ(unstuffed._restartOffsets, restartsExpected);
+    EXPECT_EQ(unstuffed._scanBytes, 8);
+}
+
+TEST(UnstuffScan, TruncatedScan) {
+    std::vector<uint8_t> scan = {0x12, 0x34, 0xFF};
+    auto unstuffed = unstuffScan(scan);
+    
+    std::vector<uint8_t> dataExpected = {0x12, 0x34};
+    EXPECT_EQ(unstuffed._data, dataExpected);
+    EXPECT_TRUE(unstuffed._restartOffsets.empty());
+    EXPECT_EQ(unstuffed._scanBytes, 2);
+}
+
+TEST_F(HuffmanDecoderTest, UnstuffedReadsMatchStuffed) {
+    // padding bits before RST0 are dropped by reset in both modes
+    std::vector<uint8_t> scan = {0x9F, 0xE0, 0xFF, 0x00, 0x40, 0x01, 0x23, 0x45, 0x67, 0x89,
+                                 0xFF, 0xD0, 0x94, 0xAB, 0xCD, 0xEF, 0xFF, 0x00, 0x12, 0x34, 0xFF, 0xD9};
+    auto unstuffed = unstuffScan(scan);
+    
+    BitDecoder stuffedDecoder;
+    stuffedDecoder.setTable(&table);
+    stuffedDecoder.setData(scan);
+    decoder.setUnstuffedData(unstuffed);
+    
+    for (auto bits : {3, 9, 8, 16, 16, 12}) {
+        EXPECT_EQ(decoder.nextXBits(bits), stuffedDecoder.nextXBits(bits));
+    }
+    
+    //a huffman lookup peeks past the padding, which is how the stuffed
+    //reader finds the marker before a reset
+    EXPECT_EQ(decoder.peakXBits(8), stuffedDecoder.peakXBits(8));
+    stuffedDecoder.peakXBits(16);
+    decoder.reset();
+    stuffedDecoder.reset();
+    
+    EXPECT_EQ(decoder.nextHuffmanByte(), 0x03);
+    EXPECT_EQ(stuffedDecoder.nextHuffmanByte(), 0x03);
+    for (auto bits : {5, 16, 16, 16}) {
+        EXPECT_EQ(decoder.nextXBits(bits), stuffedDecoder.nextXBits(bits));
+    }
+}
+
+TEST(BitDecoderTest, SeekToBitPosition) {
+    // stuffed FFs either side of plain data, then RST0 and more data
+    std::vector<uint8_t> scan = {0xFF, 0x00, 0xA5, 0xFF, 0x00, 0x3C, 0xFF, 0xD0, 0x81, 0x7E};
+    
+    for (size_t skip = 0; skip < 32; skip++) {
+        BitDecoder decoder;
+        decoder.setData(scan);
+        for (size_t bits = skip; bits > 0; bits -= std::min<size_t>(bits, 8)) {
+            decoder.nextXBits(std::min<size_t>(bits, 8));
+        }
+        
+        //read ahead as a huffman lookup would, which can reach the marker
+        decoder.peakXBits(16);
+        auto position = decoder.bitPosition();
+        EXPECT_EQ(position._bit, skip % 8) << skip;
+        
+        BitDecoder seeked;
+        seeked.setData(scan);
+        seeked.seek(position);
+        
+        //there are 32 bits before the marker
+        size_t remaining = std::min<size_t>(8, 32 - skip);
+        EXPECT_EQ(seeked.nextXBits(remaining), decoder.nextXBits(remaining)) << skip;
+        EXPECT_EQ(seeked.error(), DecodeError::None);
+    }
+}
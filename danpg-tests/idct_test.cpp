@@ -7,6 +7,8 @@
 
 #include <gtest/gtest.h>
 #include <string>
+#include <cmath>
+#include <numbers>
 
 #include "idct.hpp"
 
@@ -112,10 +114,59 @@ TEST(IDCTTest, IDCTFloatLoeffler) {
         -56, -58, -61, -63, -63, -62, -59, -57
     };
 
+    //idct_float_loeffler expects coefficients prescaled by the dequantisation table
+    const float fixedPoint = 1 << image::idctFractionBits(image::IdctVariant::Loeffler);
+    for (size_t i = 0; i < input.size(); i++) {
+        input[i] = std::lround(input[i] * image::idctPrescale(image::IdctVariant::Loeffler, i % 8, i / 8) * fixedPoint);
+    }
+
     image::idct_float_loeffler(input);
     EXPECT_EQ(input, output);
 }
 
+TEST(IDCTTest, IDCTLoefflerFixedPoint) {
+    image::DataUnit input = {
+        -430, -10, 20, 0, 0, 0, 0, 0,
+        20, 0, 0, 0, 0, 0, 0, 0,
+        -20, 10, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0
+    };
+    auto reference = image::idct_float(input);
+
+    //int16_t intermediates only have room for a few fraction bits
+    auto prescaled = [&](int fractionBits) {
+        image::DataUnit du;
+        for (size_t i = 0; i < input.size(); i++) {
+            du[i] = std::lround(input[i] * image::idctPrescale(image::IdctVariant::Loeffler, i % 8, i / 8) * (1 << fractionBits));
+        }
+        return du;
+    };
+
+    auto int32 = prescaled(image::loefflerFractionBits);
+    image::idct_loeffler<int32_t>(int32);
+    auto int16 = prescaled(4);
+    image::idct_loeffler<int16_t, 4>(int16);
+
+    for (size_t i = 0; i < reference.size(); i++) {
+        EXPECT_NEAR(int32[i], reference[i], 1) << i;
+        EXPECT_NEAR(int16[i], reference[i], 2) << i;
+    }
+}
+
+TEST(IDCTTest, ConstexprConstants) {
+    static_assert(image::loeffler::cosine(0) == 1.0);
+    for (int k = 0; k < 32; k++) {
+        double angle = k * std::numbers::pi / 16;
+        EXPECT_NEAR(image::loeffler::cosine(angle), std::cos(angle), 1e-12) << k;
+        EXPECT_NEAR(image::loeffler::sine(angle), std::sin(angle), 1e-12) << k;
+    }
+    EXPECT_EQ(image::loeffler::c3._fixed, std::lround(std::cos(3 * std::numbers::pi / 16) * (1 << image::loeffler::constantBits)));
+}
+
 TEST(IDCTTest, InputAndOutputOfLumaFromTestImageInteger) {
     image::DataUnit input = {
         -430, -10, 20, 0, 0, 0, 0, 0,
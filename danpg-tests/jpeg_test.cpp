@@ -6,10 +6,14 @@
 //
 
 #include <gtest/gtest.h>
+#include <algorithm>
 #include <string>
 #include <strstream>
 
 #include "jpeg.hpp"
+#include "mjpeg.hpp"
+#include "synthjpeg.hpp"
+#include "testframes.hpp"
 
 using namespace image;
 
@@ -27,11 +31,14 @@ TEST(JPEGTest, DecodeBlock) {
     auto dcTable = HuffmanTable::build(huffmanDCTableData);
     auto acTable = HuffmanTable::build(huffmanACTableData);
     
-    Jpeg::ImageComponent ic = {0, 1, 1, 0, &q};
+    auto dq = Jpeg::dequantisationTable(q, IdctVariant::Reference);
+    Jpeg::ImageComponent ic = {0, 1, 1, 0, &q, &dq};
     Jpeg::ImageComponentInScan icS = {1, 0, 0, &ic, &dcTable, &acTable};
     
     Jpeg j;
-    auto du = j.readBlock(dec, icS);
+    Jpeg::DataUnit du;
+    du.fill(0);
+    j.readBlock(dec, icS, du.data(), 8);
     
     EXPECT_EQ(icS.prevDC, -43);
         
@@ -41,4 +48,333 @@ TEST(JPEGTest, DecodeBlock) {
     EXPECT_EQ(du, expectedResult);
 }
 
+TEST(JPEGTest, SkipBlockConsumesSameBits) {
+    std::vector<uint8_t> blockData = { 0xE5, 0x03, 0x2E, 0xEE, 0x6A, 0x5A, 0xC3};
+    
+    auto dcTable = annexKTable(defaultDCLuminance);
+    auto acTable = annexKTable(defaultACLuminance);
+    
+    Jpeg::QuantisationTable q;
+    q.fill(1);
+    auto dq = Jpeg::dequantisationTable(q, IdctVariant::Reference);
+    Jpeg::ImageComponent ic = {0, 1, 1, 0, &q, &dq};
+    Jpeg::ImageComponentInScan icS = {1, 0, 0, &ic, &dcTable, &acTable};
+    
+    Jpeg j;
+    BitDecoder readDec;
+    readDec.setData(blockData);
+    Jpeg::DataUnit du;
+    du.fill(0);
+    j.readBlock(readDec, icS, du.data(), 8);
+    
+    BitDecoder skipDec;
+    skipDec.setData(blockData);
+    j.skipBlock(skipDec, icS);
+    
+    //skipping leaves the decoder where reading did and does not touch the dc prediction
+    EXPECT_EQ(skipDec.position(), readDec.position());
+    EXPECT_EQ(skipDec.peakXBits(16), readDec.peakXBits(16));
+    EXPECT_EQ(icS.prevDC, -43);
+}
+
+TEST(JPEGTest, MultiSymbolReadsSameBlock) {
+    std::vector<uint8_t> blockData = { 0xE5, 0x03, 0x2E, 0xEE, 0x6A, 0x5A, 0xC3};
+    
+    auto dcTable = annexKTable(defaultDCLuminance);
+    auto acTable = annexKTable(defaultACLuminance);
+    auto multiSymbolTable = acTable;
+    multiSymbolTable.buildMultiSymbol();
+    
+    Jpeg::QuantisationTable q;
+    q.fill(2);
+    auto dq = Jpeg::dequantisationTable(q, IdctVariant::Reference);
+    Jpeg::ImageComponent ic = {0, 1, 1, 0, &q, &dq};
+    Jpeg::ImageComponentInScan icS = {1, 0, 0, &ic, &dcTable, &acTable};
+    Jpeg::ImageComponentInScan multiSymbolIcS = {1, 0, 0, &ic, &dcTable, &multiSymbolTable};
+    
+    Jpeg j;
+    BitDecoder dec;
+    dec.setData(blockData);
+    Jpeg::DataUnit du;
+    du.fill(0);
+    auto lastWritten = j.readBlock(dec, icS, du.data(), 8);
+    
+    BitDecoder multiSymbolDec;
+    multiSymbolDec.setData(blockData);
+    Jpeg::DataUnit multiSymbolDu;
+    multiSymbolDu.fill(0);
+    auto multiSymbolLastWritten = j.readBlock(multiSymbolDec, multiSymbolIcS, multiSymbolDu.data(), 8);
+    
+    EXPECT_EQ(multiSymbolDu, du);
+    EXPECT_EQ(multiSymbolLastWritten, lastWritten);
+    EXPECT_EQ(multiSymbolIcS.prevDC, icS.prevDC);
+    EXPECT_EQ(multiSymbolDec.peakXBits(16), dec.peakXBits(16));
+}
+
+TEST(JPEGTest, SamplingLayoutDispatch422) {
+    std::vector<uint8_t> sof = { 0x08, 0x00, 0x10, 0x00, 0x20, 0x03, 0x01, 0x21, 0x00, 0x02, 0x11, 0x01, 0x03, 0x11, 0x01};
+    
+    Jpeg j;
+    j.sofBaselineDCT(sof);
+    
+    EXPECT_EQ(j._mcuWidth, 16);
+    EXPECT_EQ(j._mcuHeight, 8);
+    EXPECT_TRUE((j._mcuDecoder == &Jpeg::readMCUSampled<2, 1>));
+    EXPECT_TRUE((j._chromaPlacer == &Jpeg::copyChromaToImageSampled<2, 1>));
+    EXPECT_EQ(j._chromaKernelSuffix, "_2x1");
+}
+
+TEST(JPEGTest, SamplingLayoutDispatchGreyscale) {
+    std::vector<uint8_t> sof = { 0x08, 0x00, 0x10, 0x00, 0x20, 0x01, 0x01, 0x22, 0x00};
+    
+    Jpeg j;
+    j.sofBaselineDCT(sof);
+    
+    EXPECT_EQ(j._mcuWidth, 8);
+    EXPECT_EQ(j._mcuHeight, 8);
+    EXPECT_TRUE(j._mcuDecoder == &Jpeg::readMCUGreyscale);
+}
+
+TEST(JPEGTest, SamplingLayoutDispatchGeneric) {
+    std::vector<uint8_t> sof = { 0x08, 0x00, 0x10, 0x00, 0x20, 0x03, 0x01, 0x22, 0x00, 0x02, 0x21, 0x01, 0x03, 0x11, 0x01};
+    
+    Jpeg j;
+    j.sofBaselineDCT(sof);
+    
+    EXPECT_EQ(j._mcuWidth, 16);
+    EXPECT_EQ(j._mcuHeight, 16);
+    EXPECT_TRUE(j._mcuDecoder == &Jpeg::readMCU);
+    EXPECT_TRUE(j._chromaPlacer == &Jpeg::copyChromaToImage);
+}
+
+//decodes with readMCU and copyChromaToImage whatever the sampling layout,
+//as a reference for the specialised paths
+DecodedImage decodeGeneric(std::span<uint8_t> data) {
+    Jpeg j;
+    size_t position = 0;
+    while (position < data.size()) {
+        auto rest = data.subspan(position);
+        if (!j._inScan) {
+            position += j.readData(rest);
+            j._mcuDecoder = &Jpeg::readMCU;
+            j._chromaPlacer = &Jpeg::copyChromaToImage;
+        } else {
+            position += j.readScanData(rest);
+        }
+    }
+    return j.takeImage();
+}
+
+TEST(JPEGTest, SamplingLayoutsDecodeSamePixels) {
+    struct Layout {
+        uint8_t _h, _v;
+        bool _greyscale;
+    };
+    //3x1 has no specialisation, so both decodes take the generic path
+    for (auto layout : {Layout{1, 1, false}, Layout{2, 1, false}, Layout{2, 2, false}, Layout{1, 1, true}, Layout{3, 1, false}}) {
+        SyntheticJpeg synth;
+        //edges that don't fill an MCU
+        synth._width = 77;
+        synth._height = 35;
+        synth._h = layout._h;
+        synth._v = layout._v;
+        synth._greyscale = layout._greyscale;
+        auto data = synth.encode();
+        SCOPED_TRACE(testing::Message() << int(layout._h) << "x" << int(layout._v) << (layout._greyscale ? " grey" : ""));
+        
+        auto image = decodeImage(data);
+        ASSERT_TRUE(image);
+        EXPECT_EQ(image._error, DecodeError::None);
+        auto reference = decodeGeneric(data);
+        ASSERT_TRUE(reference);
+        ASSERT_EQ(reference._width, image._width);
+        ASSERT_EQ(reference._height, image._height);
+        
+        int minimum = 255, maximum = 0;
+        for (size_t i = 0; i < image._width * image._height; i++) {
+            auto& pixel = image.colours()[i];
+            auto& expected = reference.colours()[i];
+            ASSERT_EQ(pixel.r, expected.r) << "pixel " << i;
+            ASSERT_EQ(pixel.g, expected.g) << "pixel " << i;
+            ASSERT_EQ(pixel.b, expected.b) << "pixel " << i;
+            if (layout._greyscale) {
+                ASSERT_EQ(pixel.r, pixel.g);
+                ASSERT_EQ(pixel.g, pixel.b);
+            }
+            minimum = std::min({minimum, pixel.r, pixel.g, pixel.b});
+            maximum = std::max({maximum, pixel.r, pixel.g, pixel.b});
+        }
+        //the gradients come out in range and the picture isn't flat
+        EXPECT_GE(minimum, 0);
+        EXPECT_LE(maximum, 255);
+        EXPECT_GT(maximum - minimum, 64);
+    }
+}
+
+TEST(JPEGTest, LumaModeSkipsChroma) {
+    std::vector<uint8_t> sof = { 0x08, 0x00, 0x25, 0x00, 0x4B, 0x03, 0x01, 0x22, 0x00, 0x02, 0x11, 0x01, 0x03, 0x11, 0x01};
+    
+    Jpeg j;
+    j._outputMode = Jpeg::OutputMode::Luma;
+    j.sofBaselineDCT(sof);
+    
+    EXPECT_TRUE((j._mcuDecoder == &Jpeg::readMCUSampled<2, 2, true>));
+    EXPECT_EQ(j._image, nullptr);
+    EXPECT_NE(j._lumaImage, nullptr);
+    EXPECT_NE(j._imageComponents[0]._icSubPixelData, nullptr);
+    EXPECT_EQ(j._imageComponents[1]._icSubPixelData, nullptr);
+    EXPECT_EQ(j._imageComponents[2]._icSubPixelData, nullptr);
+    j.releaseImage();
+}
+
+TEST(JPEGTest, DestinationReplacesImage) {
+    //4:2:0, 37 lines of 75 samples
+    std::vector<uint8_t> sof = { 0x08, 0x00, 0x25, 0x00, 0x4B, 0x03, 0x01, 0x22, 0x00, 0x02, 0x11, 0x01, 0x03, 0x11, 0x01};
+    std::vector<uint8_t> pixels(37 * 320);
+    
+    Jpeg j;
+    j._destination = {pixels.data(), 320, PixelFormat::RGBA8};
+    j.sofBaselineDCT(sof);
+    EXPECT_EQ(j._image, nullptr);
+    
+    Jpeg narrow;
+    narrow._destination = {pixels.data(), 75 * 4 - 1, PixelFormat::RGBA8};
+    EXPECT_THROW(narrow.sofBaselineDCT(sof), std::runtime_error);
+}
+
+TEST(JPEGTest, PlanesPaddedToWholeMCUs) {
+    //4:2:0, 37 lines of 75 samples
+    std::vector<uint8_t> sof = { 0x08, 0x00, 0x25, 0x00, 0x4B, 0x03, 0x01, 0x22, 0x00, 0x02, 0x11, 0x01, 0x03, 0x11, 0x01};
+    
+    Jpeg j;
+    j.sofBaselineDCT(sof);
+    
+    auto& luma = j._imageComponents[0];
+    EXPECT_EQ(luma._width, 80);
+    EXPECT_EQ(luma._stride, 80);
+    EXPECT_EQ(luma._rows, 48);
+    
+    auto& chroma = j._imageComponents[1];
+    EXPECT_EQ(chroma._width, 40);
+    EXPECT_EQ(chroma._stride, 48);
+    EXPECT_EQ(chroma._rows, 24);
+    
+    for (auto& ic : j._imageComponents) {
+        EXPECT_EQ(reinterpret_cast<uintptr_t>(ic._icSubPixelData.get()) % 64, 0);
+    }
+}
+
+
+TEST(JPEGTest, TruncatedScanKeepsDecodedMCUs) {
+    //greyscale, 32 lines of 8 samples, four MCUs but data for only the first
+    Jpeg::QuantisationTable q = { 0x0A, 0x0A, 0x0A, 0x0A, 0x0A, 0x0A, 0x11, 0x0A, 0x0A, 0x11, 0x18, 0x11, 0x11, 0x11, 0x18, 0x21, 0x18, 0x18, 0x18, 0x18, 0x21, 0x2A, 0x21, 0x21, 0x21, 0x21, 0x21, 0x2A, 0x32, 0x2A, 0x2A, 0x2A, 0x2A, 0x2A, 0x2A, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x3C, 0x3C, 0x3C, 0x3C, 0x3C, 0x3C, 0x47, 0x47, 0x47, 0x47, 0x47, 0x4F, 0x4F, 0x4F, 0x4F, 0x4F, 0x4F, 0x4F, 0x4F, 0x4F, 0x4F};
+    std::vector<uint8_t> blockData = { 0xE5, 0x03, 0x2E, 0xEE, 0x6A};
+    
+    Jpeg j;
+    std::vector<uint8_t> dqt = {0x00};
+    dqt.insert(dqt.end(), q.begin(), q.end());
+    j.quantisationTable(dqt);
+    for (auto* table : {&defaultDCLuminance, &defaultACLuminance}) {
+        std::vector<uint8_t> dht = *table;
+        j.huffmanTable(dht);
+    }
+    
+    std::vector<uint8_t> sof = { 0x08, 0x00, 0x20, 0x00, 0x08, 0x01, 0x01, 0x11, 0x00};
+    j.sofBaselineDCT(sof);
+    std::vector<uint8_t> sos = { 0x01, 0x01, 0x00, 0x00, 0x3F, 0x00};
+    j.startOfScan(sos);
+    
+    EXPECT_NO_THROW(j.readScanData(blockData));
+    EXPECT_EQ(j._scanError, DecodeError::OutOfData);
+    EXPECT_EQ(j._mcusDecoded, 1);
+    EXPECT_FALSE(j._inScan);
+    j.releaseImage();
+}
+
+
+//greyscale 8 rows high with the tables in DHT segments, every block a zero
+//dc and eob. segments go in after SOI.
+std::vector<uint8_t> greyFrame(uint8_t width, const std::vector<uint8_t>& scan, const std::vector<uint8_t>& segments = {}) {
+    TestFrame frame;
+    frame._width = width;
+    frame._segments = segments;
+    return frame.frame(scan);
+}
+
+TEST(JPEGTest, DecodeImageKeepsOnlyPixels) {
+    //one block, b00 b1010 padded with ones
+    auto data = greyFrame(8, {0x2B});
+    
+    AccountingAllocator allocator;
+    DecodeOptions options;
+    options._allocator = &allocator;
+    auto decoded = decodeImage(data, options);
+    
+    EXPECT_TRUE(decoded);
+    EXPECT_EQ(decoded._width, 8);
+    EXPECT_EQ(decoded._height, 8);
+    EXPECT_EQ(decoded._stride, 8 * sizeof(Colour));
+    EXPECT_EQ(decoded._error, DecodeError::None);
+    EXPECT_EQ(decoded.colours()[63].g, 128);
+    EXPECT_EQ(decoded.luma(), nullptr);
+    //the planes went with the decoder
+    EXPECT_EQ(allocator.liveBytes(), 8 * 8 * sizeof(Colour));
+    
+    auto moved = std::move(decoded);
+    EXPECT_FALSE(decoded);
+    EXPECT_EQ(moved.colours()[0].r, 128);
+    
+    moved = DecodedImage();
+    EXPECT_EQ(allocator.liveBytes(), 0);
+}
+
+#ifdef DANPG_DECODE_STATS
+TEST(JPEGTest, DecodeStatsCountsSymbols) {
+    //two blocks of b00 b1010, a zero dc difference then eob
+    auto data = greyFrame(16, {0x28, 0xAF});
+    auto decoded = decodeImage(data);
+    
+    auto& luma = decoded._stats._components[0];
+    EXPECT_EQ(luma._blocks, 2);
+    EXPECT_EQ(luma._dcCodeLengths[2], 2);
+    EXPECT_EQ(luma._dcMagnitudes[0], 2);
+    EXPECT_EQ(luma._acCodeLengths[4], 2);
+    EXPECT_EQ(luma._eobPositions[0], 2);
+    EXPECT_EQ(luma.zeroBlockRatio(), 1.0);
+    EXPECT_EQ(decoded._stats._components[1]._blocks, 0);
+    ASSERT_EQ(decoded._stats._bitsPerMCURow.size(), 1);
+    EXPECT_EQ(decoded._stats._bitsPerMCURow[0], 12);
+}
+#endif
+
+TEST(JPEGTest, DecodeThumbnailWhenBigEnough) {
+    //8x8 thumbnail in the Exif segment of a 16x8 image
+    auto thumbnail = greyFrame(8, {0x2B});
+    std::vector<uint8_t> tiff = {'I', 'I', 0x2A, 0x00, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x0E, 0x00, 0x00, 0x00, 0x02, 0x00};
+    uint32_t thumbnailOffset = static_cast<uint32_t>(tiff.size() + 2 * 12 + 4);
+    for (auto [tag, value] : {std::pair{0x0201u, thumbnailOffset}, std::pair{0x0202u, static_cast<uint32_t>(thumbnail.size())}}) {
+        tiff.insert(tiff.end(), {static_cast<uint8_t>(tag), static_cast<uint8_t>(tag >> 8), 0x04, 0x00, 0x01, 0x00, 0x00, 0x00});
+        tiff.insert(tiff.end(), {static_cast<uint8_t>(value), static_cast<uint8_t>(value >> 8), static_cast<uint8_t>(value >> 16), static_cast<uint8_t>(value >> 24)});
+    }
+    tiff.insert(tiff.end(), 4, 0x00);
+    tiff.insert(tiff.end(), thumbnail.begin(), thumbnail.end());
+    
+    size_t length = tiff.size() + 8;
+    std::vector<uint8_t> exif = {0xFF, 0xE1, static_cast<uint8_t>(length >> 8), static_cast<uint8_t>(length), 'E', 'x', 'i', 'f', 0x00, 0x00};
+    exif.insert(exif.end(), tiff.begin(), tiff.end());
+    //two blocks, b00 b1010 b00 b1010 padded with ones
+    auto data = greyFrame(16, {0x28, 0xAF}, exif);
+    
+    auto small = decodeThumbnail(data, 8, 8);
+    EXPECT_EQ(small._width, 8);
+    EXPECT_EQ(small._error, DecodeError::None);
+    EXPECT_EQ(small.colours()[63].r, 128);
+    
+    auto full = decodeThumbnail(data, 12, 8);
+    EXPECT_EQ(full._width, 16);
+    EXPECT_EQ(full._height, 8);
+    EXPECT_EQ(full._error, DecodeError::None);
+    EXPECT_EQ(full.colours()[127].b, 128);
+}
+
 }
@@ -0,0 +1,153 @@
+//
+//  lazyjpeg_test.cpp
+//  danpg-tests
+//
+//  Created by Daniel Burke on 19/10/2026.
+//
+
+#include <gtest/gtest.h>
+#include <vector>
+
+#include "lazyjpeg.hpp"
+#include "testframes.hpp"
+
+using namespace image;
+
+namespace {
+
+//greyscale 40x24, five blocks across and three down. every block is a dc
+//difference of +1 and an eob, so each is a level brighter than the one before
+//it, or than the restart before it.
+std::vector<uint8_t> steppedFrame(uint8_t restartInterval) {
+    TestFrame frame;
+    frame._width = 40;
+    frame._height = 24;
+    frame._restartInterval = restartInterval;
+    
+    //b010 b1 b1010, a whole byte per block
+    std::vector<uint8_t> scan;
+    for (size_t block = 0; block < 15; block++) {
+        scan.push_back(0x5A);
+        if (restartInterval && (block + 1) % restartInterval == 0 && block != 14) {
+            scan.insert(scan.end(), {0xFF, static_cast<uint8_t>(0xD0 + ((block + 1) / restartInterval - 1) % 8)});
+        }
+    }
+    return frame.frame(scan);
+}
+
+TEST(LazyJpegTest, TilesMatchFullDecode) {
+    for (uint8_t restartInterval : {0, 2}) {
+        auto data = steppedFrame(restartInterval);
+        auto full = decodeImage(data);
+        ASSERT_EQ(full._error, DecodeError::None);
+        
+        LazyJpeg lazy(data, 16);
+        EXPECT_EQ(lazy.tileColumns(), 3);
+        EXPECT_EQ(lazy.tileRows(), 2);
+        
+        //bottom right first, the rows above it are decoded on the way
+        for (auto [column, row] : {std::pair{2, 1}, std::pair{0, 0}, std::pair{1, 0}, std::pair{0, 1}, std::pair{2, 0}, std::pair{1, 1}}) {
+            auto tile = lazy.tile(column, row);
+            ASSERT_EQ(tile->_error, DecodeError::None);
+            EXPECT_EQ(tile->_width, column == 2 ? 8 : 16);
+            EXPECT_EQ(tile->_height, row == 1 ? 8 : 16);
+            
+            for (size_t y = 0; y < tile->_height; y++) {
+                for (size_t x = 0; x < tile->_width; x++) {
+                    auto expected = full.colours()[(row * 16 + y) * 40 + column * 16 + x];
+                    auto actual = tile->colours()[y * tile->_width + x];
+                    ASSERT_EQ(actual.r, expected.r) << column << ", " << row << " at " << x << ", " << y;
+                    ASSERT_EQ(actual.b, expected.b);
+                }
+            }
+        }
+        
+        EXPECT_GT(full.colours()[8].r, full.colours()[0].r);
+    }
+}
+
+TEST(LazyJpegTest, CheckpointsAndCache) {
+    auto data = steppedFrame(0);
+    LazyJpeg lazy(data, 16, 2);
+    
+    lazy.tile(0, 0);
+    EXPECT_EQ(lazy._mcuRowsDecoded, 2);
+    
+    auto cached = lazy.tile(0, 0);
+    EXPECT_EQ(lazy._tileCacheHits, 1);
+    EXPECT_EQ(lazy._mcuRowsDecoded, 2);
+    
+    //starts from the checkpoint at the third row
+    lazy.tile(1, 1);
+    EXPECT_EQ(lazy._mcuRowsDecoded, 3);
+    
+    //pushes the first tile out of the cache, which still holds on to it
+    lazy.tile(2, 0);
+    lazy.tile(0, 0);
+    EXPECT_EQ(lazy._tilesDecoded, 4);
+    EXPECT_EQ(lazy._tileCacheHits, 1);
+    EXPECT_EQ(cached->_width, 16);
+    
+    EXPECT_THROW(lazy.tile(3, 0), std::out_of_range);
+}
+
+TEST(LazyJpegTest, TruncatedScan) {
+    auto data = steppedFrame(0);
+    //cut the scan in the second row
+    data.erase(data.end() - 2 - 8, data.end());
+    LazyJpeg lazy(data, 16);
+    
+    EXPECT_EQ(lazy.tile(0, 1)->_error, DecodeError::OutOfData);
+    EXPECT_EQ(lazy.tile(0, 0)->_error, DecodeError::OutOfData);
+    EXPECT_EQ(lazy.tile(0, 0)->colours()[0].g, 129);
+}
+
+TEST(LazyJpegTest, StartsFromIndex) {
+    for (uint8_t restartInterval : {0, 2}) {
+        auto data = steppedFrame(restartInterval);
+        auto full = decodeImage(data);
+        
+        LazyJpeg indexer(data, 16);
+        auto index = ScanIndex::deserialise(indexer.index(2).serialise());
+        ASSERT_EQ(index._entries.size(), 2);
+        EXPECT_EQ(index._entries[1]._mcuRow, 2);
+        
+        //the bottom row of tiles starts at the third MCU row, which is indexed
+        LazyJpeg lazy(data, 16);
+        lazy.useIndex(index);
+        auto tile = lazy.tile(1, 1);
+        EXPECT_EQ(lazy._mcuRowsDecoded, 1);
+        for (size_t x = 0; x < 16; x++) {
+            EXPECT_EQ(tile->colours()[x].g, full.colours()[16 * 40 + 16 + x].g);
+        }
+        
+        //the other restart interval makes for different headers
+        auto other = steppedFrame(restartInterval ? 0 : 2);
+        EXPECT_THROW(lazy.useIndex(LazyJpeg(other, 16).index()), std::runtime_error);
+    }
+}
+
+TEST(LazyJpegTest, IndexReachesPastCorruptRows) {
+    auto data = steppedFrame(0);
+    LazyJpeg indexer(data, 16);
+    auto index = indexer.index(2);
+    
+    //the second row's first blocks become b1111 1111 1111 1111, which isn't a code
+    auto scanStart = data.end() - 2 - 15;
+    std::copy_n(std::vector<uint8_t>{0xFF, 0x00, 0xFF, 0x00}.begin(), 4, scanStart + 5);
+    
+    LazyJpeg unindexed(data, 16);
+    EXPECT_EQ(unindexed.tile(0, 1)->_error, DecodeError::HuffmanCode);
+    
+    //the partial tile wasn't kept, the index reaches past the corrupt row
+    unindexed.useIndex(index);
+    EXPECT_EQ(unindexed.tile(0, 1)->_error, DecodeError::None);
+    EXPECT_EQ(unindexed._tileCacheHits, 0);
+    
+    LazyJpeg indexed(data, 16);
+    indexed.useIndex(index);
+    EXPECT_EQ(indexed.tile(0, 1)->_error, DecodeError::None);
+    EXPECT_EQ(indexed.tile(0, 0)->_error, DecodeError::HuffmanCode);
+}
+
+}
@@ -0,0 +1,121 @@
+//
+//  mjpeg_test.cpp
+//  danpg-tests
+//
+//  Created by Daniel Burke on 19/10/2026.
+//
+
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <stdexcept>
+#include <vector>
+
+#include "mjpeg.hpp"
+#include "testframes.hpp"
+
+using namespace image;
+
+namespace {
+
+//greyscale 8x8 frame without DHT, one block coded with the Annex K tables
+std::vector<uint8_t> greyFrame(std::vector<uint8_t> scan) {
+    TestFrame frame;
+    frame._huffmanTables = false;
+    return frame.frame(scan);
+}
+
+TEST(MjpegTest, DefaultTablesWhenDHTMissing) {
+    // dc ssss 0 b00, eob b1010, padded with ones
+    auto frame = greyFrame({0x2B});
+
+    MjpegDecoder decoder;
+    EXPECT_EQ(decoder.decodeFrame(frame), frame.size());
+    EXPECT_EQ(decoder.frame()._scanError, DecodeError::None);
+    EXPECT_EQ(decoder.frame()._mcusDecoded, 1);
+    for (size_t i = 0; i < 64; i++) {
+        EXPECT_EQ(decoder.frame()._image[i].r, 128);
+    }
+    EXPECT_EQ(decoder._huffmanTablesBuilt, 0);
+}
+
+TEST(MjpegTest, StreamReusesFrameSetup) {
+    // second frame: dc ssss 2 b011, diff 3 b11, eob b1010
+    auto first = greyFrame({0x2B});
+    auto second = greyFrame({0x7D, 0x7F});
+
+    //frames separated by junk, as between multipart parts
+    std::vector<uint8_t> stream = {0x2D, 0x2D, 0xFF};
+    stream.insert(stream.end(), first.begin(), first.end());
+    stream.insert(stream.end(), {0x0D, 0x0A});
+    stream.insert(stream.end(), second.begin(), second.end());
+    stream.insert(stream.end(), first.begin(), first.end());
+
+    MjpegDecoder decoder;
+    std::vector<int> topLeft;
+    const Colour* image = nullptr;
+    auto frames = decoder.decodeStream(stream, [&](const Jpeg& frame, size_t frameIndex) {
+        EXPECT_EQ(frameIndex, topLeft.size());
+        EXPECT_EQ(frame._scanError, DecodeError::None);
+        if (image) {
+            EXPECT_EQ(frame._image, image);
+        }
+        image = frame._image;
+        topLeft.push_back(frame._image[0].r);
+    });
+
+    EXPECT_EQ(frames, 3);
+    EXPECT_EQ(decoder._frameHeadersReused, 2);
+    //dc of 3 at a quantiser of 8 lifts every sample by 3
+    std::vector<int> expected = {128, 131, 128};
+    EXPECT_EQ(topLeft, expected);
+}
+
+
+TEST(MjpegTest, CorruptScanResyncsOnEOI) {
+    // b111111111 isn't a dc code, so the scan stops at the start and leaves
+    // the rest, stuffing included, for the marker walk
+    std::vector<uint8_t> scan;
+    for (size_t i = 0; i < 16; i++) {
+        scan.insert(scan.end(), {0xFF, 0x00, 0x12});
+    }
+    scan.insert(scan.end(), {0xFF, 0xD0, 0x34});
+    auto corrupt = greyFrame(scan);
+    auto next = greyFrame({0x2B});
+    std::vector<uint8_t> stream = corrupt;
+    stream.insert(stream.end(), next.begin(), next.end());
+
+    MjpegDecoder decoder;
+    std::vector<DecodeError> errors;
+    auto frames = decoder.decodeStream(stream, [&](const Jpeg& frame, size_t) {
+        errors.push_back(frame._scanError);
+    });
+
+    EXPECT_EQ(frames, 2);
+    ASSERT_EQ(errors.size(), 2);
+    EXPECT_NE(errors[0], DecodeError::None);
+    EXPECT_EQ(errors[1], DecodeError::None);
+}
+
+TEST(MjpegTest, RejectsQuantisationTableOutOfRange) {
+    //DQT destination 5, there are four
+    std::vector<uint8_t> dqt = {0xFF, 0xDB, 0x00, 0x43, 0x05};
+    dqt.insert(dqt.end(), 64, 0x08);
+    TestFrame frame;
+    frame._huffmanTables = false;
+    frame._segments = dqt;
+
+    auto badTable = frame.frame({0x2B});
+
+    MjpegDecoder decoder;
+    EXPECT_THROW(decoder.decodeFrame(badTable), std::runtime_error);
+
+    //the component selecting table 4
+    auto data = greyFrame({0x2B});
+    std::vector<uint8_t> sofMarker = {0xFF, 0xC0};
+    auto sof = std::search(data.begin(), data.end(), sofMarker.begin(), sofMarker.end());
+    ASSERT_NE(sof, data.end());
+    sof[12] = 0x04;
+    EXPECT_THROW(decoder.decodeFrame(data), std::runtime_error);
+}
+
+}
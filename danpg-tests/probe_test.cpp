@@ -0,0 +1,147 @@
+//
+//  probe_test.cpp
+//  danpg-tests
+//
+//  Created by Daniel Burke on 19/10/2026.
+//
+
+#include <gtest/gtest.h>
+#include <vector>
+
+#include "probe.hpp"
+
+using namespace image;
+
+namespace {
+
+//headers only, the entropy data is filler with a stuffed 0xff and a restart marker
+std::vector<uint8_t> headerStream(uint8_t sofMarker) {
+    return {
+        0xff, 0xd8,
+        0xff, 0xe1, 0x00, 0x0c, 'E', 'x', 'i', 'f', 0x00, 0x00, 'I', 'I', 0x2a, 0x00,
+        0xff, sofMarker, 0x00, 0x11, 0x08, 0x00, 0x25, 0x00, 0x4b, 0x03, 0x01, 0x22, 0x00, 0x02, 0x11, 0x01, 0x03, 0x11, 0x01,
+        0xff, 0xdd, 0x00, 0x04, 0x00, 0x06,
+        0xff, 0xda, 0x00, 0x0c, 0x03, 0x01, 0x00, 0x02, 0x11, 0x03, 0x11, 0x00, 0x3f, 0x00,
+        0x12, 0xff, 0x00, 0x34, 0xff, 0xd0, 0x56,
+        0xff, 0xdd, 0x00, 0x04, 0x00, 0x02,
+        0xff, 0xda, 0x00, 0x0c, 0x03, 0x01, 0x00, 0x02, 0x11, 0x03, 0x11, 0x00, 0x3f, 0x00,
+        0x78, 0x9a,
+        0xff, 0xd9,
+    };
+}
+
+//an Exif APP1 whose IFD1 points at a four byte thumbnail, ahead of the
+//headers from headerStream
+std::vector<uint8_t> exifStream(bool bigEndian) {
+    std::vector<uint8_t> tiff;
+    auto put16 = [&](uint16_t value) {
+        tiff.insert(tiff.end(), bigEndian ? std::initializer_list<uint8_t>{uint8_t(value >> 8), uint8_t(value)} : std::initializer_list<uint8_t>{uint8_t(value), uint8_t(value >> 8)});
+    };
+    auto put32 = [&](uint32_t value) {
+        put16(bigEndian ? value >> 16 : value);
+        put16(bigEndian ? value : value >> 16);
+    };
+    auto putEntry = [&](uint16_t tag, uint16_t type, uint32_t value) {
+        put16(tag);
+        put16(type);
+        put32(1);
+        if (type == 3) {
+            put16(value);
+            put16(0);
+        } else {
+            put32(value);
+        }
+    };
+    
+    tiff.insert(tiff.end(), {uint8_t(bigEndian ? 'M' : 'I'), uint8_t(bigEndian ? 'M' : 'I')});
+    put16(42);
+    put32(8);
+    //IFD0 with no entries, then IFD1
+    put16(0);
+    put32(14);
+    put16(3);
+    putEntry(0x0103, 3, 6);
+    putEntry(0x0201, 4, 56);
+    putEntry(0x0202, 4, 4);
+    put32(0);
+    tiff.insert(tiff.end(), {0xff, 0xd8, 0xff, 0xd9});
+    
+    size_t length = tiff.size() + 8;
+    std::vector<uint8_t> data = {0xff, 0xd8, 0xff, 0xe1, uint8_t(length >> 8), uint8_t(length), 'E', 'x', 'i', 'f', 0x00, 0x00};
+    data.insert(data.end(), tiff.begin(), tiff.end());
+    auto headers = headerStream(0xc0);
+    data.insert(data.end(), headers.begin() + 16, headers.end());
+    return data;
+}
+
+TEST(ProbeTest, BaselineHeader) {
+    auto data = headerStream(0xc0);
+    auto info = probe(data);
+    
+    ASSERT_TRUE(info.valid());
+    EXPECT_EQ(info._width, 75);
+    EXPECT_EQ(info._height, 37);
+    EXPECT_EQ(info._precision, 8);
+    EXPECT_TRUE(info._baseline);
+    EXPECT_FALSE(info._progressive);
+    EXPECT_EQ(info._restartInterval, 6);
+    
+    ASSERT_EQ(info._componentCount, 3);
+    EXPECT_EQ(info._components[0]._h, 2);
+    EXPECT_EQ(info._components[0]._v, 2);
+    EXPECT_EQ(info._components[1]._h, 1);
+    EXPECT_EQ(info._components[2]._tq, 1);
+    
+    EXPECT_EQ(info._scans, 1);
+    EXPECT_EQ(info._scanOffset, 55);
+    EXPECT_EQ(info._exifOffset, 12);
+    EXPECT_EQ(info._exifLength, 4);
+}
+
+TEST(ProbeTest, WalkPastScans) {
+    auto data = headerStream(0xc2);
+    auto info = probe(data, true);
+    
+    ASSERT_TRUE(info.valid());
+    EXPECT_FALSE(info._baseline);
+    EXPECT_TRUE(info._progressive);
+    EXPECT_EQ(info._scans, 2);
+    EXPECT_EQ(info._scanOffset, 55);
+    //the second restart interval sits between the scans
+    EXPECT_EQ(info._restartInterval, 2);
+}
+
+TEST(ProbeTest, MalformedHeaders) {
+    std::vector<uint8_t> notJpeg = {0x89, 'P', 'N', 'G'};
+    EXPECT_FALSE(probe(notJpeg).valid());
+    
+    auto truncated = headerStream(0xc0);
+    truncated.resize(25);
+    EXPECT_FALSE(probe(truncated).valid());
+    
+    std::vector<uint8_t> noFrame = {0xff, 0xd8, 0xff, 0xd9};
+    EXPECT_FALSE(probe(noFrame).valid());
+}
+
+TEST(ProbeTest, ExifThumbnail) {
+    for (bool bigEndian : {false, true}) {
+        auto data = exifStream(bigEndian);
+        auto info = probe(data);
+        ASSERT_TRUE(info.valid());
+        
+        auto thumbnail = exifThumbnail(data, info);
+        ASSERT_EQ(thumbnail.size(), 4);
+        EXPECT_EQ(thumbnail.data(), data.data() + 12 + 56);
+        EXPECT_EQ(thumbnail[3], 0xd9);
+        
+        //a thumbnail running past the segment isn't returned
+        info._exifLength -= 1;
+        EXPECT_TRUE(exifThumbnail(data, info).empty());
+    }
+    
+    //no IFD1
+    auto data = headerStream(0xc0);
+    EXPECT_TRUE(exifThumbnail(data, probe(data)).empty());
+}
+
+}
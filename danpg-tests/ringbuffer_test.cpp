@@ -0,0 +1,87 @@
+//
+//  ringbuffer_test.cpp
+//  danpg-tests
+//
+//  Created by Daniel Burke on 19/10/2026.
+//
+
+#include <gtest/gtest.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "ringbuffer.hpp"
+
+using namespace image;
+
+namespace {
+
+TEST(RingBufferTest, PushPopInOrder) {
+    RingBuffer<int, 4> ring;
+    
+    EXPECT_TRUE(ring.tryPush(1));
+    EXPECT_TRUE(ring.tryPush(2));
+    
+    int value = 0;
+    EXPECT_TRUE(ring.tryPop(value));
+    EXPECT_EQ(value, 1);
+    EXPECT_TRUE(ring.tryPop(value));
+    EXPECT_EQ(value, 2);
+    EXPECT_FALSE(ring.tryPop(value));
+}
+
+TEST(RingBufferTest, FullAndWrapAround) {
+    RingBuffer<int, 4> ring;
+    
+    for (int i = 0; i < 4; i++) {
+        EXPECT_TRUE(ring.tryPush(i));
+    }
+    EXPECT_FALSE(ring.tryPush(4));
+    
+    int value = 0;
+    for (int lap = 0; lap < 3; lap++) {
+        EXPECT_TRUE(ring.tryPop(value));
+        EXPECT_TRUE(ring.tryPush(4 + lap));
+    }
+    
+    for (int expected = 3; expected < 7; expected++) {
+        EXPECT_TRUE(ring.tryPop(value));
+        EXPECT_EQ(value, expected);
+    }
+}
+
+TEST(RingBufferTest, SingleProducerManyConsumers) {
+    RingBuffer<size_t, 8> ring;
+    const size_t count = 10000;
+    std::atomic<size_t> sum = 0;
+    std::atomic<size_t> popped = 0;
+    
+    std::vector<std::thread> consumers;
+    for (int i = 0; i < 4; i++) {
+        consumers.emplace_back([&]() {
+            while (popped.load() < count) {
+                size_t value;
+                if (ring.tryPop(value)) {
+                    sum += value;
+                    popped++;
+                } else {
+                    std::this_thread::yield();
+                }
+            }
+        });
+    }
+    
+    for (size_t i = 1; i <= count; i++) {
+        while (!ring.tryPush(i)) {
+            std::this_thread::yield();
+        }
+    }
+    
+    for (auto& consumer : consumers) {
+        consumer.join();
+    }
+    
+    EXPECT_EQ(sum.load(), count * (count + 1) / 2);
+}
+
+}
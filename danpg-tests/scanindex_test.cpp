@@ -0,0 +1,73 @@
+//
+//  scanindex_test.cpp
+//  danpg-tests
+//
+//  Created by Daniel Burke on 19/10/2026.
+//
+
+#include <gtest/gtest.h>
+#include <vector>
+
+#include "scanindex.hpp"
+
+using namespace image;
+
+namespace {
+
+TEST(ScanIndexTest, SerialiseRoundTrip) {
+    ScanIndex index;
+    index._dataBytes = 12000000;
+    index._scanOffset = 623;
+    index._headerHash = 0x0123456789abcdef;
+    index._components = 3;
+    index._rowsPerEntry = 4;
+    index._entries = {
+        {0, {0, 0}, {0, 0, 0}},
+        {4, {70000, 3}, {-1024, 17, -1}},
+        {8, {140001, 7}, {2047, 0, -300}},
+    };
+    
+    auto blob = index.serialise();
+    //an entry is a handful of bytes
+    EXPECT_LT(blob.size(), 64);
+    
+    auto read = ScanIndex::deserialise(blob);
+    EXPECT_EQ(read._dataBytes, index._dataBytes);
+    EXPECT_EQ(read._scanOffset, index._scanOffset);
+    EXPECT_EQ(read._headerHash, index._headerHash);
+    EXPECT_EQ(read._components, 3);
+    EXPECT_EQ(read._rowsPerEntry, 4);
+    ASSERT_EQ(read._entries.size(), 3);
+    for (size_t i = 0; i < 3; i++) {
+        EXPECT_EQ(read._entries[i]._mcuRow, index._entries[i]._mcuRow);
+        EXPECT_EQ(read._entries[i]._position._byte, index._entries[i]._position._byte);
+        EXPECT_EQ(read._entries[i]._position._bit, index._entries[i]._position._bit);
+        EXPECT_EQ(read._entries[i]._prevDC, index._entries[i]._prevDC);
+    }
+}
+
+TEST(ScanIndexTest, RejectsBadBlobs) {
+    ScanIndex index;
+    index._components = 1;
+    index._rowsPerEntry = 1;
+    index._entries = {{0, {0, 0}, {}}, {1, {12, 5}, {-3}}};
+    auto blob = index.serialise();
+    
+    EXPECT_NO_THROW(ScanIndex::deserialise(blob));
+    EXPECT_THROW(ScanIndex::deserialise(std::span(blob).first(blob.size() - 1)), std::runtime_error);
+    
+    blob[4] = 2;
+    EXPECT_THROW(ScanIndex::deserialise(blob), std::runtime_error);
+}
+
+TEST(ScanIndexTest, HeaderHashCoversOnlyHeaders) {
+    std::vector<uint8_t> data = {0xFF, 0xD8, 0xFF, 0xDA, 0x12, 0x34};
+    auto hash = ScanIndex::hashHeaders(data, 4);
+    
+    data[5] = 0x56;
+    EXPECT_EQ(ScanIndex::hashHeaders(data, 4), hash);
+    data[1] = 0xD9;
+    EXPECT_NE(ScanIndex::hashHeaders(data, 4), hash);
+}
+
+}
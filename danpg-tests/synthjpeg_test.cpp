@@ -0,0 +1,109 @@
+//
+//  synthjpeg_test.cpp
+//  danpg-tests
+//
+//  Created by Daniel Burke on 19/10/2026.
+//
+
+#include <gtest/gtest.h>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+#include "jpeg.hpp"
+#include "probe.hpp"
+#include "synthjpeg.hpp"
+
+using namespace image;
+
+namespace {
+
+TEST(SyntheticJpegTest, SameSettingsSameBytes) {
+    SyntheticJpeg synth;
+    synth._width = 123;
+    synth._height = 45;
+    synth._restartInterval = 3;
+
+    EXPECT_EQ(synth.encode(), synth.encode());
+
+    auto other = synth;
+    other._seed = 2;
+    EXPECT_NE(synth.encode(), other.encode());
+}
+
+TEST(SyntheticJpegTest, HeadersDescribeSettings) {
+    SyntheticJpeg synth;
+    synth._width = 301;
+    synth._height = 199;
+    synth._h = 2;
+    synth._v = 1;
+    synth._restartInterval = 5;
+    auto data = synth.encode();
+
+    auto info = probe(data);
+    ASSERT_TRUE(info.valid()) << info._error;
+    EXPECT_TRUE(info._baseline);
+    EXPECT_EQ(info._width, 301);
+    EXPECT_EQ(info._height, 199);
+    EXPECT_EQ(info._restartInterval, 5);
+    ASSERT_EQ(info._componentCount, 3);
+    EXPECT_EQ(info._components[0]._h, 2);
+    EXPECT_EQ(info._components[0]._v, 1);
+    EXPECT_EQ(info._components[1]._h, 1);
+    EXPECT_EQ(info._components[2]._v, 1);
+}
+
+TEST(SyntheticJpegTest, DecodesEveryLayout) {
+    struct Layout {
+        uint8_t _h, _v;
+        bool _greyscale;
+    };
+    for (auto layout : {Layout{1, 1, false}, Layout{2, 1, false}, Layout{2, 2, false}, Layout{1, 1, true}}) {
+        for (uint16_t restartInterval : {0, 1, 7}) {
+            for (int quality : {10, 75, 100}) {
+                SyntheticJpeg synth;
+                //edges that don't fill an MCU
+                synth._width = 77;
+                synth._height = 35;
+                synth._h = layout._h;
+                synth._v = layout._v;
+                synth._greyscale = layout._greyscale;
+                synth._quality = quality;
+                synth._restartInterval = restartInterval;
+                auto data = synth.encode();
+                SCOPED_TRACE(testing::Message() << int(layout._h) << "x" << int(layout._v) << (layout._greyscale ? " grey" : "")
+                             << ", dri " << restartInterval << ", quality " << quality);
+
+                auto image = decodeImage(data);
+                ASSERT_TRUE(image);
+                EXPECT_EQ(image._error, DecodeError::None);
+                EXPECT_EQ(image._width, 77);
+                EXPECT_EQ(image._height, 35);
+
+                //restart handling differs between the two, the pixels mustn't
+                DecodeOptions unstuffed;
+                unstuffed._unstuffScan = true;
+                auto other = decodeImage(data, unstuffed);
+                ASSERT_TRUE(other);
+                EXPECT_EQ(std::memcmp(image.data(), other.data(), image._stride * image._height), 0);
+            }
+        }
+    }
+}
+
+TEST(SyntheticJpegTest, RejectsWhatBaselineCantHold) {
+    SyntheticJpeg synth;
+    synth._width = 0;
+    EXPECT_THROW(synth.encode(), std::logic_error);
+
+    synth._width = 16;
+    synth._quality = 0;
+    EXPECT_THROW(synth.encode(), std::logic_error);
+
+    synth._quality = 50;
+    synth._h = 3;
+    synth._v = 3;
+    EXPECT_THROW(synth.encode(), std::logic_error);
+}
+
+}
@@ -0,0 +1,63 @@
+//
+//  testframes.cpp
+//  danpg-tests
+//
+//  Created by Daniel Burke on 19/10/2026.
+//
+
+#include "testframes.hpp"
+
+#include "mjpeg.hpp"
+
+using namespace image;
+
+std::vector<uint8_t> TestFrame::frame(const std::vector<uint8_t>& scan) const {
+    const bool greyscale = _h == 0;
+    const uint8_t components = greyscale ? 1 : 3;
+
+    std::vector<uint8_t> data = {0xFF, 0xD8};
+    data.insert(data.end(), _segments.begin(), _segments.end());
+
+    data.insert(data.end(), {0xFF, 0xDB, 0x00, 0x43, 0x00});
+    data.insert(data.end(), 64, 0x08);
+
+    uint8_t sofLength = 8 + 3 * components;
+    data.insert(data.end(), {0xFF, 0xC0, 0x00, sofLength, 0x08,
+                             static_cast<uint8_t>(_height >> 8), static_cast<uint8_t>(_height),
+                             static_cast<uint8_t>(_width >> 8), static_cast<uint8_t>(_width), components});
+    for (uint8_t c = 0; c < components; c++) {
+        data.insert(data.end(), {static_cast<uint8_t>(c + 1), static_cast<uint8_t>(c == 0 && !greyscale ? (_h << 4) | _v : 0x11), 0x00});
+    }
+
+    if (_huffmanTables) {
+        std::vector<const std::vector<uint8_t>*> tables = {&defaultDCLuminance, &defaultACLuminance};
+        if (!greyscale) {
+            tables.insert(tables.end(), {&defaultDCChrominance, &defaultACChrominance});
+        }
+        for (auto* table : tables) {
+            size_t length = table->size() + 2;
+            data.insert(data.end(), {0xFF, 0xC4, static_cast<uint8_t>(length >> 8), static_cast<uint8_t>(length)});
+            data.insert(data.end(), table->begin(), table->end());
+        }
+    }
+
+    if (_restartInterval) {
+        data.insert(data.end(), {0xFF, 0xDD, 0x00, 0x04, static_cast<uint8_t>(_restartInterval >> 8), static_cast<uint8_t>(_restartInterval)});
+    }
+
+    uint8_t sosLength = 6 + 2 * components;
+    data.insert(data.end(), {0xFF, 0xDA, 0x00, sosLength, components});
+    for (uint8_t c = 0; c < components; c++) {
+        data.insert(data.end(), {static_cast<uint8_t>(c + 1), static_cast<uint8_t>(c == 0 ? 0x00 : 0x11)});
+    }
+    data.insert(data.end(), {0x00, 0x3F, 0x00});
+
+    data.insert(data.end(), scan.begin(), scan.end());
+    data.insert(data.end(), {0xFF, 0xD9});
+    return data;
+}
+
+HuffmanTable image::annexKTable(const std::vector<uint8_t>& definition) {
+    std::vector<uint8_t> tableDef(definition.begin() + 1, definition.end());
+    return HuffmanTable::build(tableDef);
+}
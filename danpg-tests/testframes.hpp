@@ -0,0 +1,44 @@
+//
+//  testframes.hpp
+//  danpg-tests
+//
+//  Created by Daniel Burke on 19/10/2026.
+//
+
+#ifndef testframes_hpp
+#define testframes_hpp
+
+#include <cstdint>
+#include <vector>
+
+#include "huffmantable.hpp"
+
+namespace image {
+
+//a baseline frame around hand coded entropy data, for tests that need exact
+//bits. every quantiser is 8 and the tables are the Annex K ones from
+//mjpeg.hpp, luminance for Y and chrominance for Cb and Cr, so a zero block
+//is b00 b1010 in luma and b00 b00 in chroma. SyntheticJpeg is the one for
+//realistic pictures.
+struct TestFrame {
+    uint16_t _width = 8;
+    uint16_t _height = 8;
+    //luma sampling factors of a three component frame, 0 for greyscale
+    uint8_t _h = 0;
+    uint8_t _v = 0;
+    //off leaves out DHT, for decoders that fall back to the Annex K tables
+    bool _huffmanTables = true;
+    uint16_t _restartInterval = 0;
+    //marker segments to put straight after SOI
+    std::vector<uint8_t> _segments;
+
+    //SOI, the headers, scan and EOI
+    std::vector<uint8_t> frame(const std::vector<uint8_t>& scan) const;
+};
+
+//builds one of the mjpeg.hpp table definitions, which start with Tc Th
+HuffmanTable annexKTable(const std::vector<uint8_t>& definition);
+
+}
+
+#endif /* testframes_hpp */
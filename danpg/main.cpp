@@ -7,55 +7,481 @@
 
 #include <iostream>
 #include <fstream>
+#include <filesystem>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
 
 #include <Foundation/Foundation.hpp>
 #include <Metal/Metal.hpp>
 #include <QuartzCore/QuartzCore.hpp>
 
+#include "allocator.hpp"
+#include "decodecache.hpp"
+#include "decodestats.hpp"
 #include "jpeg.hpp"
 #include "colour.hpp"
 
-void runFuncTimed(std::function<void(void)> func) {
-    std::cout << "Jpeg decode start" << std::endl;
-    auto start = std::chrono::high_resolution_clock::now();
-    
-    func();
-    
-    auto end = std::chrono::high_resolution_clock::now();
-    std::cout << "Jpeg decode duration: " << std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count() << "ms" << std::endl;
+namespace {
+
+struct Options {
+    std::vector<std::filesystem::path> inputs;
+    size_t threads = 1;
+    size_t repeat = 1;
+    size_t pipelineThreads = 0;
+    bool cpu = false;
+    bool luma = false;
+    bool unstuff = false;
+    bool multiSymbol = false;
+    bool stats = false;
+    bool verbose = false;
+    bool json = false;
+    bool output = true;
+    std::string format = "ppm";
+    std::string allocator = "heap";
+    size_t cacheMegabytes = 0;
+    std::filesystem::path outputDir = "/private/tmp";
+};
+
+struct Input {
+    std::filesystem::path path;
+    std::vector<uint8_t> data;
+};
+
+struct Result {
+    double seconds = 0;
+    size_t pixels = 0;
+    size_t peakBytes = 0; //decoder buffers live at once
+    bool ok = false;
+#ifdef DANPG_DECODE_STATS
+    image::DecodeStats stats;
+#endif
+};
+
+void printUsage() {
+    std::cout << "usage: danpg [options] <file or directory>...\n"
+              << "  --threads N    decode N images in parallel (default 1)\n"
+              << "  --repeat N     decode every input N times (default 1)\n"
+              << "  --cpu          decode without metal\n"
+              << "  --pipeline N   cpu transform threads per image (default 0)\n"
+              << "  --unstuff      remove byte stuffing before entropy decoding\n"
+              << "  --multisymbol  decode short ac codes several at a time\n"
+              << "  --luma         decode the Y plane only, the same as --format pgm\n"
+              << "  --allocator A  decoder buffers from heap, arena (one per thread) or pool (default heap)\n"
+              << "  --cache MB     serve repeated inputs from a cache of MB decoded images (default off)\n"
+              << "  --format F     output format, ppm, pgm (luma only) or rgb (raw 8 bit) (default ppm)\n"
+              << "  --output DIR   output directory (default /private/tmp)\n"
+              << "  --no-output    decode only, write nothing\n"
+              << "  --stats        report entropy decode statistics, needs DANPG_DECODE_STATS\n"
+              << "  --verbose      log each marker segment as it is parsed, timings include it\n"
+              << "  --json         print the report as json" << std::endl;
+}
+
+bool parseOptions(int argc, const char* argv[], Options& options) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        auto nextValue = [&]() -> std::string {
+            if (i + 1 >= argc) {
+                throw std::runtime_error("missing value for " + arg);
+            }
+            return argv[++i];
+        };
+
+        if (arg == "--threads") {
+            options.threads = std::max<size_t>(1, std::stoul(nextValue()));
+        } else if (arg == "--repeat") {
+            options.repeat = std::max<size_t>(1, std::stoul(nextValue()));
+        } else if (arg == "--pipeline") {
+            options.pipelineThreads = std::stoul(nextValue());
+        } else if (arg == "--cpu") {
+            options.cpu = true;
+        } else if (arg == "--unstuff") {
+            options.unstuff = true;
+        } else if (arg == "--multisymbol") {
+            options.multiSymbol = true;
+        } else if (arg == "--stats") {
+            if (!image::decodeStatsEnabled) {
+                throw std::runtime_error("--stats needs danpg built with DANPG_DECODE_STATS defined");
+            }
+            options.stats = true;
+        } else if (arg == "--verbose") {
+            options.verbose = true;
+        } else if (arg == "--luma") {
+            options.luma = true;
+        } else if (arg == "--format") {
+            options.format = nextValue();
+            if (options.format != "ppm" && options.format != "pgm" && options.format != "rgb") {
+                throw std::runtime_error("unsupported output format " + options.format);
+            }
+        } else if (arg == "--allocator") {
+            options.allocator = nextValue();
+            if (options.allocator != "heap" && options.allocator != "arena" && options.allocator != "pool") {
+                throw std::runtime_error("unknown allocator " + options.allocator);
+            }
+        } else if (arg == "--cache") {
+            options.cacheMegabytes = std::stoul(nextValue());
+        } else if (arg == "--output") {
+            options.outputDir = nextValue();
+        } else if (arg == "--no-output") {
+            options.output = false;
+        } else if (arg == "--json") {
+            options.json = true;
+        } else if (arg == "--help" || arg == "-h") {
+            return false;
+        } else {
+            options.inputs.push_back(arg);
+        }
+    }
+
+    //pgm is the only format that holds just the Y plane
+    if (options.format == "pgm") {
+        options.luma = true;
+    } else if (options.luma) {
+        if (options.format == "rgb") {
+            throw std::runtime_error("--luma output is pgm");
+        }
+        options.format = "pgm";
+    }
+
+    if (options.cacheMegabytes && options.allocator == "arena") {
+        throw std::runtime_error("cached images outlive the decode, use the heap or pool allocator");
+    }
+
+    return !options.inputs.empty();
+}
+
+bool isJpegPath(const std::filesystem::path& path) {
+    auto extension = path.extension().string();
+    std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+    return extension == ".jpg" || extension == ".jpeg";
+}
+
+std::vector<Input> loadInputs(const std::vector<std::filesystem::path>& paths) {
+    std::vector<std::filesystem::path> files;
+    for (auto& path : paths) {
+        if (std::filesystem::is_directory(path)) {
+            for (auto& entry : std::filesystem::recursive_directory_iterator(path)) {
+                if (entry.is_regular_file() && isJpegPath(entry.path())) {
+                    files.push_back(entry.path());
+                }
+            }
+        } else {
+            files.push_back(path);
+        }
+    }
+    std::sort(files.begin(), files.end());
+
+    std::vector<Input> inputs;
+    for (auto& file : files) {
+        std::ifstream f(file, std::ios::binary);
+        if (!f.is_open()) {
+            std::cerr << "unable to open " << file << std::endl;
+            continue;
+        }
+
+        Input input;
+        input.path = file;
+        input.data.assign(std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>());
+        inputs.push_back(std::move(input));
+    }
+
+    return inputs;
+}
+
+double percentile(const std::vector<double>& sorted, double p) {
+    if (sorted.empty()) {
+        return 0;
+    }
+
+    size_t index = static_cast<size_t>(p * (sorted.size() - 1) + 0.5);
+    return sorted[std::min(index, sorted.size() - 1)];
+}
+
+#ifdef DANPG_DECODE_STATS
+//json arrays in full, text as bin:count for the bins that aren't empty
+template<size_t N>
+void printHistogram(const std::array<size_t, N>& histogram, bool json) {
+    std::cout << (json ? "[" : "");
+    const char* separator = "";
+    for (size_t i = 0; i < N; i++) {
+        if (json) {
+            std::cout << separator << histogram[i];
+            separator = ", ";
+        } else if (histogram[i]) {
+            std::cout << " " << i << ":" << histogram[i];
+        }
+    }
+    std::cout << (json ? "]" : "");
+}
+
+void printStats(const image::DecodeStats& stats, bool json) {
+    //bits per MCU row depends on the width, so they're binned by powers of two
+    std::array<size_t, 64> rowBits{};
+    size_t totalRowBits = 0;
+    for (auto bits : stats._bitsPerMCURow) {
+        rowBits[std::bit_width(bits)]++;
+        totalRowBits += bits;
+    }
+    double meanRowBits = stats._bitsPerMCURow.empty() ? 0 : static_cast<double>(totalRowBits) / stats._bitsPerMCURow.size();
+
+    if (json) {
+        std::cout << ", \"stats\": {\"components\": [";
+        const char* separator = "";
+        for (auto& component : stats._components) {
+            if (!component._blocks) {
+                continue;
+            }
+            std::cout << separator << "{\"blocks\": " << component._blocks
+                      << ", \"zero_block_ratio\": " << component.zeroBlockRatio()
+                      << ", \"dc_code_lengths\": ";
+            printHistogram(component._dcCodeLengths, true);
+            std::cout << ", \"ac_code_lengths\": ";
+            printHistogram(component._acCodeLengths, true);
+            std::cout << ", \"dc_magnitudes\": ";
+            printHistogram(component._dcMagnitudes, true);
+            std::cout << ", \"ac_magnitudes\": ";
+            printHistogram(component._acMagnitudes, true);
+            std::cout << ", \"eob_positions\": ";
+            printHistogram(component._eobPositions, true);
+            std::cout << "}";
+            separator = ", ";
+        }
+        std::cout << "], \"mcu_rows\": " << stats._bitsPerMCURow.size()
+                  << ", \"mean_bits_per_mcu_row\": " << meanRowBits
+                  << ", \"bits_per_mcu_row_log2\": ";
+        printHistogram(rowBits, true);
+        std::cout << "}";
+        return;
+    }
+
+    for (size_t c = 0; c < stats._components.size(); c++) {
+        auto& component = stats._components[c];
+        if (!component._blocks) {
+            continue;
+        }
+        std::cout << "Component " << c << ": " << component._blocks << " blocks, "
+                  << component.zeroBlockRatio() * 100 << "% with only dc" << std::endl;
+        std::cout << "  dc code lengths:";
+        printHistogram(component._dcCodeLengths, false);
+        std::cout << std::endl << "  ac code lengths:";
+        printHistogram(component._acCodeLengths, false);
+        std::cout << std::endl << "  dc magnitudes:";
+        printHistogram(component._dcMagnitudes, false);
+        std::cout << std::endl << "  ac magnitudes:";
+        printHistogram(component._acMagnitudes, false);
+        std::cout << std::endl << "  eob positions:";
+        printHistogram(component._eobPositions, false);
+        std::cout << std::endl;
+    }
+    std::cout << "MCU rows: " << stats._bitsPerMCURow.size() << ", mean " << meanRowBits << " bits, log2 bins:";
+    printHistogram(rowBits, false);
+    std::cout << std::endl;
+}
+#endif
+
 }
 
 int main(int argc, const char * argv[]) {
-    
-    std::fstream f("/Users/daniel/Projects.nosync/danpg/danpg/danpg/image2.jpg");
-    
-    if (f.bad()) {
-        std::cout << "unable to open" << std::endl;
-    } else {
-        image::Jpeg jpeg;
-        
-        std::cout << "opened" << std::endl;
-        
-        NS::SharedPtr<NS::AutoreleasePool> _pool;
-        NS::SharedPtr<MTL::Device> _metalDevice;
-        _pool = NS::TransferPtr(NS::AutoreleasePool::alloc()->init());
+    Options options;
+    try {
+        if (!parseOptions(argc, argv, options)) {
+            printUsage();
+            return 1;
+        }
+    } catch (std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        printUsage();
+        return 1;
+    }
+
+    auto inputs = loadInputs(options.inputs);
+    if (inputs.empty()) {
+        std::cerr << "no jpeg inputs found" << std::endl;
+        return 1;
+    }
+
+    if (options.output) {
+        std::filesystem::create_directories(options.outputDir);
+    }
+
+    NS::SharedPtr<NS::AutoreleasePool> _pool;
+    NS::SharedPtr<MTL::Device> _metalDevice;
+    _pool = NS::TransferPtr(NS::AutoreleasePool::alloc()->init());
+    if (!options.cpu) {
         _metalDevice = NS::TransferPtr(MTL::CreateSystemDefaultDevice());
+    }
+
+    const size_t jobCount = inputs.size() * options.repeat;
+    std::vector<Result> results(jobCount);
+    std::atomic<size_t> nextJob = 0;
+
+    //pool regions and arena chunks are kept between images, so only the first
+    //decodes that need a buffer size fault its pages in
+    image::HugePagePool hugePagePool;
+    //after the pool, its images go back to it
+    std::unique_ptr<image::DecodeCache> cache;
+    if (options.cacheMegabytes) {
+        cache = std::make_unique<image::DecodeCache>(options.cacheMegabytes << 20);
+    }
+    
+    auto worker = [&]() {
+        image::ArenaAllocator arena;
+        image::Allocator* upstream = &image::defaultAllocator();
+        if (options.allocator == "arena") {
+            upstream = &arena;
+        } else if (options.allocator == "pool") {
+            upstream = &hugePagePool;
+        }
         
-        runFuncTimed([&]() {
-            f.ignore(std::numeric_limits<std::streamsize>::max());
-            std::streamsize length = f.gcount();
-            f.clear();
-            f.seekg(0, std::ios_base::beg);
-            
-            std::vector<uint8_t> data;
-            data.resize(length);
-            f.read(reinterpret_cast<char*>(&data[0]), length);
+        for (size_t job = nextJob++; job < jobCount; job = nextJob++) {
+            auto& input = inputs[job % inputs.size()];
+            auto& result = results[job];
+            auto pool = NS::TransferPtr(NS::AutoreleasePool::alloc()->init());
+
+            image::AccountingAllocator allocator(*upstream);
+            auto start = std::chrono::high_resolution_clock::now();
+            try {
+                image::DecodeOptions decodeOptions;
+                decodeOptions._metalDevice = _metalDevice.get();
+                decodeOptions._pipelineThreads = options.pipelineThreads;
+                decodeOptions._outputMode = options.luma ? image::Jpeg::OutputMode::Luma : image::Jpeg::OutputMode::Colour;
+                decodeOptions._unstuffScan = options.unstuff;
+                decodeOptions._multiSymbolAC = options.multiSymbol;
+                decodeOptions._logSegments = options.verbose;
+                decodeOptions._allocator = &allocator;
+                
+                std::shared_ptr<const image::DecodedImage> cachedImage;
+                image::DecodedImage decodedImage;
+                if (cache) {
+                    //cached images outlive the job, so they aren't counted against it
+                    decodeOptions._allocator = upstream;
+                    cachedImage = cache->decode(input.data, decodeOptions);
+                } else {
+                    decodedImage = image::decodeImage(input.data, decodeOptions);
+                }
+                const auto& decoded = cache ? *cachedImage : decodedImage;
+                auto end = std::chrono::high_resolution_clock::now();
+
+                result.seconds = std::chrono::duration<double>(end - start).count();
+                result.pixels = decoded._width * decoded._height;
+                result.peakBytes = allocator.peakBytes();
+#ifdef DANPG_DECODE_STATS
+                result.stats = decoded._stats;
+#endif
+
+                //only the first pass over the inputs is written out
+                if (decoded && options.output && job < inputs.size()) {
+                    auto outputPath = options.outputDir / input.path.filename().replace_extension("." + options.format);
+                    if (decoded.luma()) {
+                        image::writeOutPGM(outputPath.string(), decoded._width, decoded._height, std::span{decoded.luma(), result.pixels});
+                    } else if (options.format == "rgb") {
+                        image::writeOutRGB(outputPath.string(), decoded._width, decoded._height, std::span{decoded.colours(), result.pixels});
+                    } else {
+                        image::writeOutPPM(outputPath.string(), decoded._width, decoded._height, std::span{decoded.colours(), result.pixels});
+                    }
+                }
+
+                //a corrupt scan still leaves a partial image, written above but not counted
+                result.ok = decoded && decoded._error == DecodeError::None;
+                if (decoded._error != DecodeError::None) {
+                    std::cerr << input.path.string() << ": " << decodeErrorMessage(decoded._error) << ", image incomplete" << std::endl;
+                }
+            } catch (std::exception& e) {
+                std::cerr << input.path.string() << ": " << e.what() << std::endl;
+            }
             
-            jpeg = image::Jpeg(data, _metalDevice.get());
-        });
-        
-        image::writeOutPPM("/private/tmp/jpeg.ppm", jpeg._x, jpeg._y, std::span{jpeg._image, jpeg._x * jpeg._y * sizeof(image::Colour)});
+            //the decoder is gone, so everything it took from the arena is free
+            arena.reset();
+        }
+    };
+
+    auto start = std::chrono::high_resolution_clock::now();
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < options.threads; i++) {
+        threads.emplace_back(worker);
     }
-    
-    return 0;
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+
+    double wallSeconds = std::chrono::duration<double>(end - start).count();
+    size_t decoded = 0;
+    size_t pixels = 0;
+    size_t peakBytes = 0;
+    std::vector<double> latencies;
+    for (auto& result : results) {
+        if (result.ok) {
+            decoded++;
+            pixels += result.pixels;
+            peakBytes = std::max(peakBytes, result.peakBytes);
+            latencies.push_back(result.seconds * 1000.0);
+        }
+    }
+    std::sort(latencies.begin(), latencies.end());
+    //the most a worker needs for its decoder buffers, times threads sizes a pool
+    double peakMegabytes = peakBytes / 1e6;
+
+#ifdef DANPG_DECODE_STATS
+    //repeats would count the same images again
+    image::DecodeStats stats;
+    for (size_t job = 0; job < inputs.size(); job++) {
+        stats.merge(results[job].stats);
+    }
+#endif
+
+    double imagesPerSecond = decoded / wallSeconds;
+    double megapixelsPerSecond = pixels / 1e6 / wallSeconds;
+
+    if (options.json) {
+        std::cout << "{\"inputs\": " << inputs.size()
+                  << ", \"decoded\": " << decoded
+                  << ", \"failed\": " << (jobCount - decoded)
+                  << ", \"threads\": " << options.threads
+                  << ", \"repeat\": " << options.repeat
+                  << ", \"backend\": \"" << (_metalDevice ? "metal" : "cpu") << "\""
+                  << ", \"wall_seconds\": " << wallSeconds
+                  << ", \"images_per_second\": " << imagesPerSecond
+                  << ", \"megapixels_per_second\": " << megapixelsPerSecond
+                  << ", \"latency_ms\": {\"p50\": " << percentile(latencies, 0.50)
+                  << ", \"p95\": " << percentile(latencies, 0.95)
+                  << ", \"p99\": " << percentile(latencies, 0.99)
+                  << ", \"max\": " << (latencies.empty() ? 0 : latencies.back()) << "}"
+                  << ", \"peak_decoder_megabytes\": " << peakMegabytes;
+        if (cache) {
+            std::cout << ", \"cache\": {\"hits\": " << cache->hits()
+                      << ", \"waits\": " << cache->waits()
+                      << ", \"misses\": " << cache->misses() << "}";
+        }
+#ifdef DANPG_DECODE_STATS
+        if (options.stats) {
+            printStats(stats, true);
+        }
+#endif
+        std::cout << "}" << std::endl;
+    } else {
+        std::cout << "Decoded " << decoded << " of " << jobCount << " images on "
+                  << options.threads << " threads (" << (_metalDevice ? "metal" : "cpu") << ") in " << wallSeconds << "s" << std::endl;
+        std::cout << "Throughput: " << imagesPerSecond << " images/s, " << megapixelsPerSecond << " MP/s" << std::endl;
+        std::cout << "Latency: p50 " << percentile(latencies, 0.50) << "ms, p95 " << percentile(latencies, 0.95)
+                  << "ms, p99 " << percentile(latencies, 0.99) << "ms" << std::endl;
+        std::cout << "Peak decoder memory: " << peakMegabytes << " MB per image" << std::endl;
+        if (cache) {
+            std::cout << "Decode cache: " << cache->hits() << " hits, " << cache->waits() << " waits, "
+                      << cache->misses() << " misses, " << cache->cachedBytes() / 1e6 << " MB held" << std::endl;
+        }
+#ifdef DANPG_DECODE_STATS
+        if (options.stats) {
+            printStats(stats, false);
+        }
+#endif
+    }
+
+    return decoded == jobCount ? 0 : 2;
 }
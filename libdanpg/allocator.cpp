@@ -0,0 +1,233 @@
+//
+//  allocator.cpp
+//  libdanpg
+//
+//  Created by Daniel Burke on 19/10/2026.
+//
+
+#include "allocator.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+#include <stdexcept>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+using namespace image;
+
+namespace {
+
+const size_t hugePageBytes = 2 << 20;
+
+size_t roundUp(size_t value, size_t multiple) {
+    return (value + multiple - 1) / multiple * multiple;
+}
+
+size_t pageBytes() {
+    static const size_t pageSize = static_cast<size_t>(getpagesize());
+    return pageSize;
+}
+
+//transparent huge pages only back whole aligned huge pages, so map extra
+//and trim the ends to line the region up
+void* mapAligned(size_t bytes, size_t alignment) {
+    size_t slack = alignment > pageBytes() ? alignment : 0;
+    void* mapped = mmap(nullptr, bytes + slack, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapped == MAP_FAILED) {
+        throw std::bad_alloc();
+    }
+    
+    auto start = reinterpret_cast<uintptr_t>(mapped);
+    auto aligned = roundUp(start, alignment);
+    if (aligned > start) {
+        munmap(mapped, aligned - start);
+    }
+    if (slack > aligned - start) {
+        munmap(reinterpret_cast<void*>(aligned + bytes), slack - (aligned - start));
+    }
+    
+    return reinterpret_cast<void*>(aligned);
+}
+
+class HeapAllocator : public Allocator {
+public:
+    void* allocate(size_t bytes, size_t alignment) override {
+        void* memory = std::aligned_alloc(alignment, bytes);
+        if (!memory) {
+            throw std::bad_alloc();
+        }
+        return memory;
+    }
+
+    void deallocate(void* memory, size_t) override {
+        std::free(memory);
+    }
+};
+
+}
+
+Allocator& image::defaultAllocator() {
+    static HeapAllocator allocator;
+    return allocator;
+}
+
+AccountingAllocator::AccountingAllocator(Allocator& upstream) : _upstream(upstream) {
+
+}
+
+void* AccountingAllocator::allocate(size_t bytes, size_t alignment) {
+    void* memory = _upstream.allocate(bytes, alignment);
+    _allocations.fetch_add(1, std::memory_order_relaxed);
+
+    size_t live = _liveBytes.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+    size_t peak = _peakBytes.load(std::memory_order_relaxed);
+    while (live > peak && !_peakBytes.compare_exchange_weak(peak, live, std::memory_order_relaxed)) {
+    }
+
+    return memory;
+}
+
+void AccountingAllocator::deallocate(void* memory, size_t bytes) {
+    if (!memory) {
+        return;
+    }
+
+    _upstream.deallocate(memory, bytes);
+    _liveBytes.fetch_sub(bytes, std::memory_order_relaxed);
+}
+
+void AccountingAllocator::resetPeak() {
+    _peakBytes.store(_liveBytes.load(std::memory_order_relaxed), std::memory_order_relaxed);
+}
+
+ArenaAllocator::ArenaAllocator(size_t chunkBytes, Allocator& upstream) : _upstream(upstream), _chunkBytes(roundUp(chunkBytes, pageBytes())) {
+
+}
+
+ArenaAllocator::~ArenaAllocator() {
+    for (auto& chunk : _chunks) {
+        _upstream.deallocate(chunk._data, chunk._bytes);
+    }
+}
+
+void* ArenaAllocator::allocate(size_t bytes, size_t alignment) {
+    for (auto& chunk : _chunks) {
+        auto base = reinterpret_cast<uintptr_t>(chunk._data);
+        size_t offset = roundUp(base + chunk._used, alignment) - base;
+        if (offset + bytes <= chunk._bytes) {
+            chunk._used = offset + bytes;
+            return chunk._data + offset;
+        }
+    }
+    
+    //chunks are page aligned, anything bigger than a chunk gets one to itself
+    size_t chunkBytes = std::max(_chunkBytes, roundUp(bytes, pageBytes()));
+    auto data = static_cast<uint8_t*>(_upstream.allocate(chunkBytes, std::max(alignment, pageBytes())));
+    _chunks.push_back({data, chunkBytes, bytes});
+    return data;
+}
+
+void ArenaAllocator::deallocate(void*, size_t) {
+    
+}
+
+void ArenaAllocator::reset() {
+    for (auto& chunk : _chunks) {
+        chunk._used = 0;
+    }
+}
+
+size_t ArenaAllocator::capacity() const {
+    size_t bytes = 0;
+    for (auto& chunk : _chunks) {
+        bytes += chunk._bytes;
+    }
+    return bytes;
+}
+
+HugePagePool::HugePagePool(bool hugeTLB) : _hugeTLB(hugeTLB) {
+
+}
+
+HugePagePool::~HugePagePool() {
+    for (auto& region : _regions) {
+        munmap(region._data, region._bytes);
+    }
+}
+
+void* HugePagePool::allocate(size_t bytes, size_t alignment) {
+    if (alignment > pageBytes()) {
+        throw std::logic_error("pool regions are only page aligned");
+    }
+    
+    //small buffers would waste most of a huge page
+    bool huge = bytes >= hugePageBytes;
+    size_t regionBytes = roundUp(bytes, huge ? hugePageBytes : pageBytes());
+    
+    std::lock_guard<std::mutex> lock(_mutex);
+    
+    //best fit, but don't tie up a region more than twice the size needed
+    Region* best = nullptr;
+    for (auto& region : _regions) {
+        if (!region._inUse && region._bytes >= regionBytes && region._bytes <= regionBytes * 2 &&
+            (!best || region._bytes < best->_bytes)) {
+            best = &region;
+        }
+    }
+    
+    if (best) {
+        best->_inUse = true;
+        return best->_data;
+    }
+    
+    void* data = MAP_FAILED;
+#ifdef MAP_HUGETLB
+    if (huge && _hugeTLB) {
+        data = mmap(nullptr, regionBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    }
+#endif
+    
+    if (data == MAP_FAILED) {
+        data = mapAligned(regionBytes, huge ? hugePageBytes : pageBytes());
+#ifdef MADV_HUGEPAGE
+        if (huge) {
+            madvise(data, regionBytes, MADV_HUGEPAGE);
+        }
+#endif
+    }
+    
+    _regions.push_back({data, regionBytes, true});
+    return data;
+}
+
+void HugePagePool::deallocate(void* memory, size_t) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    for (auto& region : _regions) {
+        if (region._data == memory) {
+            region._inUse = false;
+            return;
+        }
+    }
+}
+
+void HugePagePool::trim() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    std::erase_if(_regions, [](const Region& region) {
+        if (region._inUse) {
+            return false;
+        }
+        munmap(region._data, region._bytes);
+        return true;
+    });
+}
+
+size_t HugePagePool::mappedBytes() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    size_t bytes = 0;
+    for (auto& region : _regions) {
+        bytes += region._bytes;
+    }
+    return bytes;
+}
@@ -0,0 +1,120 @@
+//
+//  allocator.hpp
+//  libdanpg
+//
+//  Created by Daniel Burke on 19/10/2026.
+//
+
+#ifndef allocator_hpp
+#define allocator_hpp
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+namespace image {
+
+//every buffer the decoder owns, planes and output images, comes from one of
+//these so it can be counted or placed somewhere other than the general heap
+class Allocator {
+public:
+    virtual ~Allocator() = default;
+
+    //alignment is a power of two, bytes a multiple of it
+    virtual void* allocate(size_t bytes, size_t alignment) = 0;
+    //bytes is what was asked of allocate
+    virtual void deallocate(void* memory, size_t bytes) = 0;
+};
+
+//aligned_alloc and free, so buffers from it can still be given to std::free
+Allocator& defaultAllocator();
+
+//forwards to another allocator, keeping count of what is live. safe to share
+//between threads, though then the peak covers every decode using it at once.
+class AccountingAllocator : public Allocator {
+private:
+    Allocator& _upstream;
+    std::atomic<size_t> _liveBytes = 0;
+    std::atomic<size_t> _peakBytes = 0;
+    std::atomic<size_t> _allocations = 0;
+
+public:
+    AccountingAllocator(Allocator& upstream = defaultAllocator());
+
+    void* allocate(size_t bytes, size_t alignment) override;
+    void deallocate(void* memory, size_t bytes) override;
+
+    size_t liveBytes() const { return _liveBytes.load(std::memory_order_relaxed); }
+    size_t peakBytes() const { return _peakBytes.load(std::memory_order_relaxed); }
+    size_t allocations() const { return _allocations.load(std::memory_order_relaxed); }
+    //starts a new peak from what is live now, ie: between decodes
+    void resetPeak();
+};
+
+//bump allocator over large chunks. deallocate does nothing, reset() takes
+//back everything at once and keeps the chunks for the next decode. not
+//thread safe, use one per worker.
+class ArenaAllocator : public Allocator {
+private:
+    struct Chunk {
+        uint8_t* _data;
+        size_t _bytes;
+        size_t _used;
+    };
+    
+    Allocator& _upstream;
+    size_t _chunkBytes;
+    std::vector<Chunk> _chunks;
+
+public:
+    ArenaAllocator(size_t chunkBytes = 64 << 20, Allocator& upstream = defaultAllocator());
+    ~ArenaAllocator();
+    
+    ArenaAllocator(const ArenaAllocator&) = delete;
+    ArenaAllocator& operator=(const ArenaAllocator&) = delete;
+
+    void* allocate(size_t bytes, size_t alignment) override;
+    void deallocate(void* memory, size_t bytes) override;
+
+    //everything allocated so far is free again
+    void reset();
+    size_t capacity() const;
+};
+
+//mmap regions that are kept and handed out again rather than unmapped, so a
+//buffer is only faulted in by the first decode that uses it. regions ask for
+//huge pages, MAP_HUGETLB where the system has them reserved and otherwise
+//transparent huge pages through madvise. safe to share between threads.
+class HugePagePool : public Allocator {
+private:
+    struct Region {
+        void* _data;
+        size_t _bytes;
+        bool _inUse;
+    };
+    
+    std::mutex _mutex;
+    std::vector<Region> _regions;
+    bool _hugeTLB;
+
+public:
+    //hugeTLB tries MAP_HUGETLB first, which fails without reserved pages
+    HugePagePool(bool hugeTLB = true);
+    ~HugePagePool();
+    
+    HugePagePool(const HugePagePool&) = delete;
+    HugePagePool& operator=(const HugePagePool&) = delete;
+
+    void* allocate(size_t bytes, size_t alignment) override;
+    void deallocate(void* memory, size_t bytes) override;
+
+    //unmaps the regions nobody is using
+    void trim();
+    size_t mappedBytes();
+};
+
+}
+
+#endif /* allocator_hpp */
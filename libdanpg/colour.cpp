@@ -7,7 +7,20 @@
 
 #include "colour.hpp"
 
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstdint>
 #include <fstream>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define COLOUR_X86 1
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#define COLOUR_NEON 1
+#include <arm_neon.h>
+#endif
 
 #include <Foundation/Foundation.hpp>
 #include <Metal/Metal.hpp>
@@ -29,6 +42,242 @@ inline int adjustAndClamp(float val) {
     }
 }
 
+//bt.601 coefficients scaled by 2^14. luma is prescaled by 2^3 and chroma by
+//2^5 so the high half of a 16 bit multiply leaves three fraction bits.
+const int fractionBits = 3;
+const int16_t crToR = 22970; //1.402
+const int16_t cbToG = 5638; //0.34414
+const int16_t crToG = 11700; //0.71414
+const int16_t cbToB = 29032; //1.772
+const int16_t levelShift = 128 << fractionBits;
+
+inline int16_t saturate16(int val) {
+    return static_cast<int16_t>(std::clamp(val, INT16_MIN, INT16_MAX));
+}
+
+inline int16_t mulHigh(int16_t a, int16_t b) {
+    return static_cast<int16_t>((a * b) >> 16);
+}
+
+inline int descaleAndClamp(int16_t val) {
+    return std::clamp(val >> fractionBits, 0, 255);
+}
+
+//the vector kernels do the same saturating steps in the same order
+void ycbcrToRGBPortable(Colour* data, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        auto y = saturate16(data[i].y * (1 << fractionBits));
+        auto cb = saturate16(data[i].cb * (1 << (fractionBits + 2)));
+        auto cr = saturate16(data[i].cr * (1 << (fractionBits + 2)));
+
+        auto r = saturate16(saturate16(y + mulHigh(cr, crToR)) + levelShift);
+        auto g = saturate16(saturate16(saturate16(y + levelShift) - mulHigh(cb, cbToG)) - mulHigh(cr, crToG));
+        auto b = saturate16(saturate16(y + mulHigh(cb, cbToB)) + levelShift);
+
+        data[i] = {descaleAndClamp(r), descaleAndClamp(g), descaleAndClamp(b)};
+    }
+}
+
+#ifdef COLOUR_X86
+
+//each register holds one pixel, swap to one channel per register. it is its
+//own inverse so the same call packs the channels back into pixels.
+inline void transpose(__m128i& a, __m128i& b, __m128i& c, __m128i& d) {
+    auto ab0 = _mm_unpacklo_epi32(a, b);
+    auto cd0 = _mm_unpacklo_epi32(c, d);
+    auto ab1 = _mm_unpackhi_epi32(a, b);
+    auto cd1 = _mm_unpackhi_epi32(c, d);
+    a = _mm_unpacklo_epi64(ab0, cd0);
+    b = _mm_unpackhi_epi64(ab0, cd0);
+    c = _mm_unpacklo_epi64(ab1, cd1);
+    d = _mm_unpackhi_epi64(ab1, cd1);
+}
+
+//8 pixels a step
+void ycbcrToRGBSSE2(Colour* data, size_t count) {
+    const auto zero = _mm_setzero_si128();
+    const auto shift = _mm_set1_epi16(levelShift);
+    const auto maxValue = _mm_set1_epi16(255);
+
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        auto pixels = reinterpret_cast<__m128i*>(&data[i]);
+        auto p0 = _mm_loadu_si128(pixels + 0), p1 = _mm_loadu_si128(pixels + 1);
+        auto p2 = _mm_loadu_si128(pixels + 2), p3 = _mm_loadu_si128(pixels + 3);
+        auto p4 = _mm_loadu_si128(pixels + 4), p5 = _mm_loadu_si128(pixels + 5);
+        auto p6 = _mm_loadu_si128(pixels + 6), p7 = _mm_loadu_si128(pixels + 7);
+        transpose(p0, p1, p2, p3);
+        transpose(p4, p5, p6, p7);
+
+        auto y = _mm_packs_epi32(_mm_slli_epi32(p0, fractionBits), _mm_slli_epi32(p4, fractionBits));
+        auto cb = _mm_packs_epi32(_mm_slli_epi32(p1, fractionBits + 2), _mm_slli_epi32(p5, fractionBits + 2));
+        auto cr = _mm_packs_epi32(_mm_slli_epi32(p2, fractionBits + 2), _mm_slli_epi32(p6, fractionBits + 2));
+
+        auto r = _mm_adds_epi16(_mm_adds_epi16(y, _mm_mulhi_epi16(cr, _mm_set1_epi16(crToR))), shift);
+        auto g = _mm_subs_epi16(_mm_subs_epi16(_mm_adds_epi16(y, shift), _mm_mulhi_epi16(cb, _mm_set1_epi16(cbToG))),
+                                _mm_mulhi_epi16(cr, _mm_set1_epi16(crToG)));
+        auto b = _mm_adds_epi16(_mm_adds_epi16(y, _mm_mulhi_epi16(cb, _mm_set1_epi16(cbToB))), shift);
+
+        r = _mm_min_epi16(_mm_max_epi16(_mm_srai_epi16(r, fractionBits), zero), maxValue);
+        g = _mm_min_epi16(_mm_max_epi16(_mm_srai_epi16(g, fractionBits), zero), maxValue);
+        b = _mm_min_epi16(_mm_max_epi16(_mm_srai_epi16(b, fractionBits), zero), maxValue);
+
+        p0 = _mm_unpacklo_epi16(r, zero), p1 = _mm_unpacklo_epi16(g, zero);
+        p2 = _mm_unpacklo_epi16(b, zero), p3 = zero;
+        p4 = _mm_unpackhi_epi16(r, zero), p5 = _mm_unpackhi_epi16(g, zero);
+        p6 = _mm_unpackhi_epi16(b, zero), p7 = zero;
+        transpose(p0, p1, p2, p3);
+        transpose(p4, p5, p6, p7);
+
+        _mm_storeu_si128(pixels + 0, p0), _mm_storeu_si128(pixels + 1, p1);
+        _mm_storeu_si128(pixels + 2, p2), _mm_storeu_si128(pixels + 3, p3);
+        _mm_storeu_si128(pixels + 4, p4), _mm_storeu_si128(pixels + 5, p5);
+        _mm_storeu_si128(pixels + 6, p6), _mm_storeu_si128(pixels + 7, p7);
+    }
+
+    ycbcrToRGBPortable(data + i, count - i);
+}
+
+//as above but two pixels to a register. the transpose and packs stay within
+//each 128 bit lane, the channels come out in a shuffled pixel order that the
+//return trip undoes.
+__attribute__((target("avx2")))
+inline void transpose(__m256i& a, __m256i& b, __m256i& c, __m256i& d) {
+    auto ab0 = _mm256_unpacklo_epi32(a, b);
+    auto cd0 = _mm256_unpacklo_epi32(c, d);
+    auto ab1 = _mm256_unpackhi_epi32(a, b);
+    auto cd1 = _mm256_unpackhi_epi32(c, d);
+    a = _mm256_unpacklo_epi64(ab0, cd0);
+    b = _mm256_unpackhi_epi64(ab0, cd0);
+    c = _mm256_unpacklo_epi64(ab1, cd1);
+    d = _mm256_unpackhi_epi64(ab1, cd1);
+}
+
+//16 pixels a step
+__attribute__((target("avx2")))
+void ycbcrToRGBAVX2(Colour* data, size_t count) {
+    const auto zero = _mm256_setzero_si256();
+    const auto shift = _mm256_set1_epi16(levelShift);
+    const auto maxValue = _mm256_set1_epi16(255);
+
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        auto pixels = reinterpret_cast<__m256i*>(&data[i]);
+        auto p0 = _mm256_loadu_si256(pixels + 0), p1 = _mm256_loadu_si256(pixels + 1);
+        auto p2 = _mm256_loadu_si256(pixels + 2), p3 = _mm256_loadu_si256(pixels + 3);
+        auto p4 = _mm256_loadu_si256(pixels + 4), p5 = _mm256_loadu_si256(pixels + 5);
+        auto p6 = _mm256_loadu_si256(pixels + 6), p7 = _mm256_loadu_si256(pixels + 7);
+        transpose(p0, p1, p2, p3);
+        transpose(p4, p5, p6, p7);
+
+        auto y = _mm256_packs_epi32(_mm256_slli_epi32(p0, fractionBits), _mm256_slli_epi32(p4, fractionBits));
+        auto cb = _mm256_packs_epi32(_mm256_slli_epi32(p1, fractionBits + 2), _mm256_slli_epi32(p5, fractionBits + 2));
+        auto cr = _mm256_packs_epi32(_mm256_slli_epi32(p2, fractionBits + 2), _mm256_slli_epi32(p6, fractionBits + 2));
+
+        auto r = _mm256_adds_epi16(_mm256_adds_epi16(y, _mm256_mulhi_epi16(cr, _mm256_set1_epi16(crToR))), shift);
+        auto g = _mm256_subs_epi16(_mm256_subs_epi16(_mm256_adds_epi16(y, shift), _mm256_mulhi_epi16(cb, _mm256_set1_epi16(cbToG))),
+                                   _mm256_mulhi_epi16(cr, _mm256_set1_epi16(crToG)));
+        auto b = _mm256_adds_epi16(_mm256_adds_epi16(y, _mm256_mulhi_epi16(cb, _mm256_set1_epi16(cbToB))), shift);
+
+        r = _mm256_min_epi16(_mm256_max_epi16(_mm256_srai_epi16(r, fractionBits), zero), maxValue);
+        g = _mm256_min_epi16(_mm256_max_epi16(_mm256_srai_epi16(g, fractionBits), zero), maxValue);
+        b = _mm256_min_epi16(_mm256_max_epi16(_mm256_srai_epi16(b, fractionBits), zero), maxValue);
+
+        p0 = _mm256_unpacklo_epi16(r, zero), p1 = _mm256_unpacklo_epi16(g, zero);
+        p2 = _mm256_unpacklo_epi16(b, zero), p3 = zero;
+        p4 = _mm256_unpackhi_epi16(r, zero), p5 = _mm256_unpackhi_epi16(g, zero);
+        p6 = _mm256_unpackhi_epi16(b, zero), p7 = zero;
+        transpose(p0, p1, p2, p3);
+        transpose(p4, p5, p6, p7);
+
+        _mm256_storeu_si256(pixels + 0, p0), _mm256_storeu_si256(pixels + 1, p1);
+        _mm256_storeu_si256(pixels + 2, p2), _mm256_storeu_si256(pixels + 3, p3);
+        _mm256_storeu_si256(pixels + 4, p4), _mm256_storeu_si256(pixels + 5, p5);
+        _mm256_storeu_si256(pixels + 6, p6), _mm256_storeu_si256(pixels + 7, p7);
+    }
+
+    ycbcrToRGBSSE2(data + i, count - i);
+}
+
+#endif
+
+#ifdef COLOUR_NEON
+
+inline int16x8_t mulHigh(int16x8_t a, int16_t b) {
+    return vcombine_s16(vshrn_n_s32(vmull_n_s16(vget_low_s16(a), b), 16),
+                        vshrn_n_s32(vmull_n_s16(vget_high_s16(a), b), 16));
+}
+
+inline int16x8_t narrow(int32x4_t low, int32x4_t high, int shift) {
+    return vcombine_s16(vqmovn_s32(vshlq_s32(low, vdupq_n_s32(shift))),
+                        vqmovn_s32(vshlq_s32(high, vdupq_n_s32(shift))));
+}
+
+inline int16x8_t descaleAndClamp(int16x8_t val) {
+    return vminq_s16(vmaxq_s16(vshrq_n_s16(val, fractionBits), vdupq_n_s16(0)), vdupq_n_s16(255));
+}
+
+//8 pixels a step, the structured loads and stores deinterleave the channels
+void ycbcrToRGBNEON(Colour* data, size_t count) {
+    const auto shift = vdupq_n_s16(levelShift);
+
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        auto pixels = reinterpret_cast<int32_t*>(&data[i]);
+        auto low = vld4q_s32(pixels);
+        auto high = vld4q_s32(pixels + 16);
+
+        auto y = narrow(low.val[0], high.val[0], fractionBits);
+        auto cb = narrow(low.val[1], high.val[1], fractionBits + 2);
+        auto cr = narrow(low.val[2], high.val[2], fractionBits + 2);
+
+        auto r = descaleAndClamp(vqaddq_s16(vqaddq_s16(y, mulHigh(cr, crToR)), shift));
+        auto g = descaleAndClamp(vqsubq_s16(vqsubq_s16(vqaddq_s16(y, shift), mulHigh(cb, cbToG)), mulHigh(cr, crToG)));
+        auto b = descaleAndClamp(vqaddq_s16(vqaddq_s16(y, mulHigh(cb, cbToB)), shift));
+
+        int32x4x4_t lowOut = {{vmovl_s16(vget_low_s16(r)), vmovl_s16(vget_low_s16(g)), vmovl_s16(vget_low_s16(b)), vdupq_n_s32(0)}};
+        int32x4x4_t highOut = {{vmovl_s16(vget_high_s16(r)), vmovl_s16(vget_high_s16(g)), vmovl_s16(vget_high_s16(b)), vdupq_n_s32(0)}};
+        vst4q_s32(pixels, lowOut);
+        vst4q_s32(pixels + 16, highOut);
+    }
+
+    ycbcrToRGBPortable(data + i, count - i);
+}
+
+#endif
+
+}
+
+bool image::colourKernelSupported(ColourKernel kernel) {
+    switch (kernel) {
+        case ColourKernel::Portable:
+            return true;
+#ifdef COLOUR_X86
+        case ColourKernel::SSE2:
+            return true;
+        case ColourKernel::AVX2:
+            return __builtin_cpu_supports("avx2");
+#endif
+#ifdef COLOUR_NEON
+        case ColourKernel::NEON:
+            return true;
+#endif
+        default:
+            return false;
+    }
+}
+
+ColourKernel image::bestColourKernel() {
+    static const ColourKernel best = [] {
+        for (auto kernel : {ColourKernel::AVX2, ColourKernel::SSE2, ColourKernel::NEON}) {
+            if (colourKernelSupported(kernel)) {
+                return kernel;
+            }
+        }
+        return ColourKernel::Portable;
+    }();
+
+    return best;
 }
 
 Colour image::ycbcrToRGB(const Colour& ycbcr) {
@@ -38,14 +287,184 @@ Colour image::ycbcrToRGB(const Colour& ycbcr) {
     return {r, g, b};
 }
 
+void image::ycbcrToRGBFixedPoint(Colour *data, size_t count, ColourKernel kernel) {
+    if (!colourKernelSupported(kernel)) {
+        throw std::logic_error("colour kernel not supported on this cpu");
+    }
+
+    switch (kernel) {
+#ifdef COLOUR_X86
+        case ColourKernel::SSE2:
+            ycbcrToRGBSSE2(data, count);
+            break;
+        case ColourKernel::AVX2:
+            ycbcrToRGBAVX2(data, count);
+            break;
+#endif
+#ifdef COLOUR_NEON
+        case ColourKernel::NEON:
+            ycbcrToRGBNEON(data, count);
+            break;
+#endif
+        default:
+            ycbcrToRGBPortable(data, count);
+            break;
+    }
+}
+
+size_t image::bytesPerPixel(PixelFormat format) {
+    switch (format) {
+        case PixelFormat::RGB8:
+            return 3;
+        case PixelFormat::RGBA8:
+        case PixelFormat::BGRA8:
+            return 4;
+        case PixelFormat::Grey8:
+            return 1;
+    }
+    
+    throw std::logic_error("unknown pixel format");
+}
+
+void image::packPixels(const Colour* rgb, size_t count, PixelFormat format, uint8_t* out) {
+    //converted colours are already clamped to 0-255
+    switch (format) {
+        case PixelFormat::RGB8:
+            for (size_t i = 0; i < count; i++, out += 3) {
+                out[0] = static_cast<uint8_t>(rgb[i].r);
+                out[1] = static_cast<uint8_t>(rgb[i].g);
+                out[2] = static_cast<uint8_t>(rgb[i].b);
+            }
+            break;
+        case PixelFormat::RGBA8:
+            for (size_t i = 0; i < count; i++, out += 4) {
+                out[0] = static_cast<uint8_t>(rgb[i].r);
+                out[1] = static_cast<uint8_t>(rgb[i].g);
+                out[2] = static_cast<uint8_t>(rgb[i].b);
+                out[3] = 255;
+            }
+            break;
+        case PixelFormat::BGRA8:
+            for (size_t i = 0; i < count; i++, out += 4) {
+                out[0] = static_cast<uint8_t>(rgb[i].b);
+                out[1] = static_cast<uint8_t>(rgb[i].g);
+                out[2] = static_cast<uint8_t>(rgb[i].r);
+                out[3] = 255;
+            }
+            break;
+        case PixelFormat::Grey8:
+            throw std::logic_error("grey output is written from the luma plane, not packed from colour");
+    }
+}
+
+size_t image::bytesPerElement(TensorType type) {
+    switch (type) {
+        case TensorType::Float32:
+            return 4;
+        case TensorType::Float16:
+            return 2;
+        case TensorType::Int8:
+            return 1;
+    }
+    
+    throw std::logic_error("unknown tensor type");
+}
+
+uint16_t image::floatToHalf(float value) {
+    uint32_t bits = std::bit_cast<uint32_t>(value);
+    uint16_t sign = (bits >> 16) & 0x8000;
+    uint32_t floatExponent = (bits >> 23) & 0xff;
+    uint32_t mantissa = bits & 0x7fffff;
+    
+    if (floatExponent == 0xff) {
+        return sign | 0x7c00 | (mantissa ? 0x200 : 0);
+    }
+    
+    int exponent = static_cast<int>(floatExponent) - 127 + 15;
+    if (exponent >= 31) {
+        return sign | 0x7c00;
+    }
+    
+    //round to nearest even, a carry out of the mantissa correctly bumps the exponent
+    auto roundShift = [](uint32_t value, uint32_t shift) {
+        uint32_t result = value >> shift;
+        uint32_t remainder = value & ((1u << shift) - 1);
+        uint32_t halfway = 1u << (shift - 1);
+        if (remainder > halfway || (remainder == halfway && (result & 1))) {
+            result++;
+        }
+        return result;
+    };
+    
+    if (exponent <= 0) {
+        if (exponent < -10) {
+            return sign;
+        }
+        return sign | roundShift(mantissa | 0x800000, 14 - exponent);
+    }
+    
+    return sign | ((exponent << 10) + roundShift(mantissa, 13));
+}
+
+TensorWriter::TensorWriter(const TensorOutput& output, size_t width, size_t height) : _output(output), _width(width), _height(height) {
+    for (size_t c = 0; c < 3; c++) {
+        for (size_t v = 0; v < 256; v++) {
+            float normalised = (v / 255.f - _output._mean[c]) / _output._std[c];
+            _float32Table[c][v] = normalised;
+            _float16Table[c][v] = floatToHalf(normalised);
+            _int8Table[c][v] = static_cast<int8_t>(std::clamp(std::lround(normalised / _output._int8Scale), -128l, 127l));
+        }
+    }
+}
+
+template<typename T>
+void TensorWriter::writeLine(const std::array<std::array<T, 256>, 3>& table, const Colour* rgb, size_t y) const {
+    const size_t planeSize = _width * _height;
+    T* image = static_cast<T*>(_output._data) + _output._batchIndex * 3 * planeSize;
+    
+    if (_output._layout == TensorLayout::NCHW) {
+        T* r = &image[y * _width];
+        T* g = r + planeSize;
+        T* b = g + planeSize;
+        for (size_t x = 0; x < _width; x++) {
+            r[x] = table[0][rgb[x].r];
+            g[x] = table[1][rgb[x].g];
+            b[x] = table[2][rgb[x].b];
+        }
+    } else {
+        T* row = &image[y * _width * 3];
+        for (size_t x = 0; x < _width; x++) {
+            row[x * 3 + 0] = table[0][rgb[x].r];
+            row[x * 3 + 1] = table[1][rgb[x].g];
+            row[x * 3 + 2] = table[2][rgb[x].b];
+        }
+    }
+}
+
+void TensorWriter::writeLine(const Colour* rgb, size_t y) const {
+    switch (_output._type) {
+        case TensorType::Float32:
+            writeLine(_float32Table, rgb, y);
+            break;
+        case TensorType::Float16:
+            writeLine(_float16Table, rgb, y);
+            break;
+        case TensorType::Int8:
+            writeLine(_int8Table, rgb, y);
+            break;
+    }
+}
+
 void image::ycbcrToRGBOverMCU(Colour *data, size_t width, size_t xStart, size_t yStart) {
     for (size_t y = yStart; y < (yStart + 16); y++) {
-        for (size_t x = xStart; x < (xStart + 16); x++) {
-            data[y * width + x] = ycbcrToRGB(data[y * width + x]);
-        }
+        ycbcrToRGBFixedPoint(&data[y * width + xStart], 16, bestColourKernel());
     }
 }
 
+void image::ycbcrToRGBOverImage(Colour *data, size_t width, size_t height) {
+    ycbcrToRGBFixedPoint(data, width * height, bestColourKernel());
+}
+
 void image::ycbcrToRGB_accel(MTL::Device* metalDevice, MTL::ComputeCommandEncoder* commandEncoder, Colour *data, size_t width, size_t height) {
     auto defaultLib = metalDevice->newDefaultLibrary();
     auto function = defaultLib->newFunction(MTLSTR("ycbcrToRGB"));
@@ -120,3 +539,56 @@ void image::writeOutPPM(std::string filepath, size_t width, size_t height, std::
     
     file.close();
 }
+
+void image::writeOutPGM(std::string filepath, size_t width, size_t height, std::span<uint8_t> data) {
+    std::ofstream file;
+    file.open(filepath);
+    
+    if (!file.is_open()) {
+        throw std::runtime_error("Cannot open file for writing.");
+    }
+    
+    if (width * height > data.size()) {
+        throw std::runtime_error("Width and height greater than provided data.");
+    }
+    
+    file << "P2" << std::endl;
+    file << width << " " << height << std::endl;
+    file << "255" << std::endl;
+     
+    for (size_t y = 0; y < height; y++) {
+        for (size_t x = 0; x < width; x++) {
+            file << std::to_string(data[x + y * width]) << " ";
+        }
+         
+        file << std::endl;
+    }
+    
+    file.close();
+}
+
+void image::writeOutRGB(std::string filepath, size_t width, size_t height, std::span<Colour> data) {
+    std::ofstream file;
+    file.open(filepath, std::ios::binary);
+    
+    if (!file.is_open()) {
+        throw std::runtime_error("Cannot open file for writing.");
+    }
+    
+    if (width * height > data.size()) {
+        throw std::runtime_error("Width and height greater than provided data.");
+    }
+    
+    std::vector<char> row(width * 3);
+    for (size_t y = 0; y < height; y++) {
+        for (size_t x = 0; x < width; x++) {
+            auto pixel = data[x + y * width];
+            row[x * 3] = static_cast<char>(pixel.r);
+            row[x * 3 + 1] = static_cast<char>(pixel.g);
+            row[x * 3 + 2] = static_cast<char>(pixel.b);
+        }
+        file.write(row.data(), row.size());
+    }
+    
+    file.close();
+}
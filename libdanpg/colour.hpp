@@ -8,6 +8,8 @@
 #ifndef colour_hpp
 #define colour_hpp
 
+#include <array>
+#include <cstdint>
 #include <span>
 #include <tuple>
 
@@ -62,12 +64,88 @@ struct Colour {
     }
 };
 
-inline Colour ycbcrToRGB(const Colour& ycbcr);
+//layouts for writing finished pixels into caller owned memory
+enum class PixelFormat {
+    RGB8,
+    RGBA8, //alpha is opaque
+    BGRA8,
+    Grey8, //luma only
+};
+
+size_t bytesPerPixel(PixelFormat format);
+void packPixels(const Colour* rgb, size_t count, PixelFormat format, uint8_t* out);
+
+//normalisation and layout fused into the colour conversion, for feeding
+//inference without another pass over the image
+enum class TensorLayout {
+    NCHW,
+    NHWC,
+};
+
+enum class TensorType {
+    Float32,
+    Float16, //ieee half, stored as uint16_t
+    Int8,
+};
+
+struct TensorOutput {
+    void* _data = nullptr;
+    TensorLayout _layout = TensorLayout::NCHW;
+    TensorType _type = TensorType::Float32;
+    size_t _batchIndex = 0; //slot in a batch of same sized RGB images
+    
+    //each channel is written as ((value / 255) - mean) / std
+    std::array<float, 3> _mean = {0.f, 0.f, 0.f};
+    std::array<float, 3> _std = {1.f, 1.f, 1.f};
+    float _int8Scale = 1.f / 127.f; //int8 is the normalised value / scale, rounded
+};
+
+//every 8 bit channel value maps to one output element, so writing is a lookup
+class TensorWriter {
+private:
+    TensorOutput _output;
+    size_t _width = 0;
+    size_t _height = 0;
+    
+    std::array<std::array<float, 256>, 3> _float32Table;
+    std::array<std::array<uint16_t, 256>, 3> _float16Table;
+    std::array<std::array<int8_t, 256>, 3> _int8Table;
+    
+    template<typename T>
+    void writeLine(const std::array<std::array<T, 256>, 3>& table, const Colour* rgb, size_t y) const;
+    
+public:
+    TensorWriter() {};
+    TensorWriter(const TensorOutput& output, size_t width, size_t height);
+    
+    void writeLine(const Colour* rgb, size_t y) const;
+};
+
+size_t bytesPerElement(TensorType type);
+uint16_t floatToHalf(float value);
+
+//vectorised fixed-point conversions, every kernel gives identical output
+enum class ColourKernel {
+    Portable,
+    SSE2,
+    AVX2,
+    NEON,
+};
+
+bool colourKernelSupported(ColourKernel kernel);
+ColourKernel bestColourKernel();
+
+Colour ycbcrToRGB(const Colour& ycbcr);
+void ycbcrToRGBFixedPoint(Colour* data, size_t count, ColourKernel kernel);
 void ycbcrToRGBOverMCU(Colour* data, size_t width, size_t x, size_t y);
+void ycbcrToRGBOverImage(Colour* data, size_t width, size_t height);
 void ycbcrToRGB_accel(MTL::Device* metalDevice, MTL::ComputeCommandEncoder* commandEncoder, Colour* data, size_t width, size_t height);
 
 void writeOutPPM(std::string filepath, size_t width, size_t height, std::span<Colour> data);
 void writeOutPPM(std::string filepath, size_t width, size_t height, std::span<int> data);
+void writeOutPGM(std::string filepath, size_t width, size_t height, std::span<uint8_t> data);
+//headerless 8 bit r g b, a row after the other
+void writeOutRGB(std::string filepath, size_t width, size_t height, std::span<Colour> data);
 
 }
 
@@ -0,0 +1,166 @@
+//
+//  decodecache.cpp
+//  libdanpg
+//
+//  Created by Daniel Burke on 19/10/2026.
+//
+
+#include "decodecache.hpp"
+
+#include <bit>
+#include <cstring>
+
+using namespace image;
+
+namespace {
+
+const uint64_t prime1 = 0x9E3779B185EBCA87;
+const uint64_t prime2 = 0xC2B2AE3D27D4EB4F;
+const uint64_t prime3 = 0x165667B19E3779F9;
+const uint64_t prime4 = 0x85EBCA77C2B2AE63;
+const uint64_t prime5 = 0x27D4EB2F165667C5;
+
+uint64_t hashRound(uint64_t accumulator, uint64_t lane) {
+    accumulator += lane * prime2;
+    return std::rotl(accumulator, 31) * prime1;
+}
+
+uint64_t load64(const uint8_t* data) {
+    uint64_t value;
+    std::memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+}
+
+uint64_t image::hashBytes(std::span<const uint8_t> data, uint64_t seed) {
+    const uint8_t* bytes = data.data();
+    const size_t size = data.size();
+    size_t i = 0;
+    uint64_t hash;
+
+    if (size >= 32) {
+        //independent lanes keep several multiplies in flight
+        uint64_t lanes[4] = {seed + prime1 + prime2, seed + prime2, seed, seed - prime1};
+        for (; i + 32 <= size; i += 32) {
+            lanes[0] = hashRound(lanes[0], load64(&bytes[i]));
+            lanes[1] = hashRound(lanes[1], load64(&bytes[i + 8]));
+            lanes[2] = hashRound(lanes[2], load64(&bytes[i + 16]));
+            lanes[3] = hashRound(lanes[3], load64(&bytes[i + 24]));
+        }
+
+        hash = std::rotl(lanes[0], 1) + std::rotl(lanes[1], 7) + std::rotl(lanes[2], 12) + std::rotl(lanes[3], 18);
+        for (auto lane : lanes) {
+            hash = (hash ^ hashRound(0, lane)) * prime1 + prime4;
+        }
+    } else {
+        hash = seed + prime5;
+    }
+
+    hash += size;
+    for (; i + 8 <= size; i += 8) {
+        hash = std::rotl(hash ^ hashRound(0, load64(&bytes[i])), 27) * prime1 + prime4;
+    }
+    for (; i < size; i++) {
+        hash = std::rotl(hash ^ (bytes[i] * prime5), 11) * prime1;
+    }
+
+    hash ^= hash >> 33;
+    hash *= prime2;
+    hash ^= hash >> 29;
+    hash *= prime3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+DecodeCache::DecodeCache(size_t byteBudget) : _byteBudget(byteBudget) {
+
+}
+
+std::shared_ptr<const DecodedImage> DecodeCache::decode(std::span<uint8_t> data, const DecodeOptions& options) {
+    //only the output mode changes the pixels, the rest is how they're made
+    const uint64_t key = hashBytes(data, static_cast<uint64_t>(options._outputMode));
+    auto same = [&](std::span<const uint8_t> other, Jpeg::OutputMode outputMode) {
+        return outputMode == options._outputMode && other.size() == data.size() &&
+               std::memcmp(other.data(), data.data(), data.size()) == 0;
+    };
+
+    std::unique_lock<std::mutex> lock(_mutex);
+    auto cached = _images.find(key);
+    if (cached != _images.end() && same(cached->second._data, cached->second._outputMode)) {
+        _hits.fetch_add(1, std::memory_order_relaxed);
+        _recent.splice(_recent.begin(), _recent, cached->second._recent);
+        return cached->second._image;
+    }
+
+    auto pending = _pending.find(key);
+    if (pending != _pending.end() && same(pending->second._data, pending->second._outputMode)) {
+        _waits.fetch_add(1, std::memory_order_relaxed);
+        auto decoding = pending->second._image;
+        lock.unlock();
+        return decoding.get();
+    }
+
+    _misses.fetch_add(1, std::memory_order_relaxed);
+    if (cached != _images.end() || pending != _pending.end()) {
+        //another jpeg with the same hash has the slot, decode around it
+        lock.unlock();
+        return std::make_shared<const DecodedImage>(decodeImage(data, options));
+    }
+
+    std::promise<Image> promise;
+    _pending.emplace(key, PendingImage{promise.get_future().share(), data, options._outputMode});
+    lock.unlock();
+
+    Image image;
+    try {
+        image = std::make_shared<const DecodedImage>(decodeImage(data, options));
+    } catch (...) {
+        lock.lock();
+        _pending.erase(key);
+        lock.unlock();
+        promise.set_exception(std::current_exception());
+        throw;
+    }
+
+    lock.lock();
+    _pending.erase(key);
+    if (*image && image->_error == DecodeError::None) {
+        insert(key, image, data, options._outputMode);
+    }
+    lock.unlock();
+
+    promise.set_value(image);
+    return image;
+}
+
+void DecodeCache::insert(uint64_t key, Image image, std::span<const uint8_t> data, Jpeg::OutputMode outputMode) {
+    size_t bytes = image->_stride * image->_height;
+    if (bytes > _byteBudget) {
+        //would push everything else out and still not fit
+        return;
+    }
+
+    while (_cachedBytes + bytes > _byteBudget) {
+        auto evicted = _images.find(_recent.back());
+        _cachedBytes -= evicted->second._bytes;
+        _images.erase(evicted);
+        _recent.pop_back();
+    }
+
+    _recent.push_front(key);
+    _images[key] = {std::move(image), bytes, _recent.begin(), std::vector<uint8_t>(data.begin(), data.end()), outputMode};
+    _cachedBytes += bytes;
+}
+
+void DecodeCache::clear() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _images.clear();
+    _recent.clear();
+    _cachedBytes = 0;
+}
+
+size_t DecodeCache::cachedBytes() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _cachedBytes;
+}
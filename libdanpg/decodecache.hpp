@@ -0,0 +1,93 @@
+//
+//  decodecache.hpp
+//  libdanpg
+//
+//  Created by Daniel Burke on 19/10/2026.
+//
+
+#ifndef decodecache_hpp
+#define decodecache_hpp
+
+#include <atomic>
+#include <cstdint>
+#include <future>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <unordered_map>
+#include <vector>
+
+#include "decodedimage.hpp"
+#include "jpeg.hpp"
+
+namespace image {
+
+//64 bit hash, four multiply and rotate lanes in the manner of xxHash64. fast
+//rather than cryptographic.
+uint64_t hashBytes(std::span<const uint8_t> data, uint64_t seed = 0);
+
+//decoded images kept by a hash of the jpeg bytes and the options that change
+//the pixels, so a popular image is decoded once and after that costs a hash
+//and a compare. each image keeps a copy of its jpeg, so two files with the
+//same hash are never mistaken for each other. images are shared and never
+//changed, the least recently used are dropped once the cached pixels pass the
+//byte budget, the jpeg copies are small beside them and aren't counted. a
+//request for an image already being decoded waits for that decode instead of
+//starting another. safe to share between threads.
+class DecodeCache {
+public:
+    DecodeCache(size_t byteBudget = 256 << 20);
+
+    //options._allocator must outlive the cache and every image handed out.
+    //only complete images are cached. one with an error, an empty one or a
+    //decode that throws is handed to the callers waiting on it and no further,
+    //the next request decodes again.
+    std::shared_ptr<const DecodedImage> decode(std::span<uint8_t> data, const DecodeOptions& options = {});
+
+    void clear();
+
+    size_t cachedBytes();
+    size_t hits() const { return _hits.load(std::memory_order_relaxed); }
+    size_t misses() const { return _misses.load(std::memory_order_relaxed); }
+    //requests that arrived while their image was being decoded
+    size_t waits() const { return _waits.load(std::memory_order_relaxed); }
+
+private:
+    typedef std::shared_ptr<const DecodedImage> Image;
+
+    struct CachedImage {
+        Image _image;
+        size_t _bytes;
+        std::list<uint64_t>::iterator _recent;
+        //what was decoded, compared on every hit
+        std::vector<uint8_t> _data;
+        Jpeg::OutputMode _outputMode;
+    };
+
+    struct PendingImage {
+        std::shared_future<Image> _image;
+        //the caller's bytes, valid while the decode is pending
+        std::span<const uint8_t> _data;
+        Jpeg::OutputMode _outputMode;
+    };
+
+    //with _mutex held
+    void insert(uint64_t key, Image image, std::span<const uint8_t> data, Jpeg::OutputMode outputMode);
+
+    std::mutex _mutex;
+    size_t _byteBudget;
+    size_t _cachedBytes = 0;
+    //most recently used first
+    std::list<uint64_t> _recent;
+    std::unordered_map<uint64_t, CachedImage> _images;
+    std::unordered_map<uint64_t, PendingImage> _pending;
+
+    std::atomic<size_t> _hits = 0;
+    std::atomic<size_t> _misses = 0;
+    std::atomic<size_t> _waits = 0;
+};
+
+}
+
+#endif /* decodecache_hpp */
@@ -0,0 +1,68 @@
+//
+//  decodedimage.hpp
+//  libdanpg
+//
+//  Created by Daniel Burke on 19/10/2026.
+//
+
+#ifndef decodedimage_hpp
+#define decodedimage_hpp
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#include "allocator.hpp"
+#include "colour.hpp"
+#include "decodestats.hpp"
+#include "huffmantable.hpp"
+
+namespace image {
+
+//the pixels of a finished decode and nothing else. owns its buffer, which goes
+//back to the allocator it came from, so moving one is a few words.
+class DecodedImage {
+public:
+    enum class Format {
+        Colour, //one image::Colour per pixel
+        Grey8, //one byte of luma per pixel
+    };
+
+    size_t _width = 0;
+    size_t _height = 0;
+    size_t _stride = 0; //bytes between rows
+    Format _format = Format::Colour;
+    //set when the scan stopped early, the rows after it are incomplete
+    DecodeError _error = DecodeError::None;
+#ifdef DANPG_DECODE_STATS
+    DecodeStats _stats;
+#endif
+
+private:
+    struct BufferDeleter {
+        Allocator* _allocator;
+        size_t _bytes;
+        void operator()(uint8_t* buffer) const { _allocator->deallocate(buffer, _bytes); }
+    };
+    std::unique_ptr<uint8_t, BufferDeleter> _buffer;
+
+public:
+    DecodedImage() {};
+    //takes buffer, which allocator gave out as bytes long
+    DecodedImage(void* buffer, size_t bytes, Allocator& allocator, size_t width, size_t height, size_t stride, Format format)
+        : _width(width), _height(height), _stride(stride), _format(format),
+          _buffer(static_cast<uint8_t*>(buffer), BufferDeleter{&allocator, bytes}) {};
+
+    DecodedImage(DecodedImage&&) = default;
+    DecodedImage& operator=(DecodedImage&&) = default;
+
+    explicit operator bool() const { return _buffer != nullptr; }
+
+    uint8_t* data() const { return _buffer.get(); }
+    Colour* colours() const { return _format == Format::Colour ? reinterpret_cast<Colour*>(_buffer.get()) : nullptr; }
+    uint8_t* luma() const { return _format == Format::Grey8 ? _buffer.get() : nullptr; }
+};
+
+}
+
+#endif /* decodedimage_hpp */
@@ -0,0 +1,70 @@
+//
+//  decodestats.hpp
+//  libdanpg
+//
+//  Created by Daniel Burke on 19/10/2026.
+//
+
+#ifndef decodestats_hpp
+#define decodestats_hpp
+
+#include <array>
+#include <cstddef>
+#include <vector>
+
+namespace image {
+
+//statistics are only collected when built with DANPG_DECODE_STATS defined.
+//otherwise none of the counting is compiled and the decode is unchanged.
+#ifdef DANPG_DECODE_STATS
+inline constexpr bool decodeStatsEnabled = true;
+#else
+inline constexpr bool decodeStatsEnabled = false;
+#endif
+
+//what the entropy decoder saw, for choosing fast path thresholds and kernels
+//from a real corpus rather than guessing. skipped blocks in luma mode aren't
+//counted.
+struct DecodeStats {
+    struct Component {
+        std::array<size_t, 17> _dcCodeLengths{}; //by bits, 1 to 16
+        std::array<size_t, 17> _acCodeLengths{};
+        std::array<size_t, 16> _dcMagnitudes{}; //ssss of every dc difference
+        std::array<size_t, 16> _acMagnitudes{}; //ssss of every ac coefficient, 0 stays empty
+        //zigzag index of the last coefficient written, so 0 is a block with
+        //only a dc coefficient and 63 one that ran to the end
+        std::array<size_t, 64> _eobPositions{};
+        size_t _blocks = 0;
+
+        double zeroBlockRatio() const { return _blocks ? static_cast<double>(_eobPositions[0]) / _blocks : 0; }
+    };
+
+    //in scan order
+    std::array<Component, 4> _components{};
+    //compressed bits each MCU row took, stuffing and markers included
+    std::vector<size_t> _bitsPerMCURow;
+
+    void merge(const DecodeStats& other) {
+        for (size_t c = 0; c < _components.size(); c++) {
+            auto& into = _components[c];
+            auto& from = other._components[c];
+            for (size_t i = 0; i < into._dcCodeLengths.size(); i++) {
+                into._dcCodeLengths[i] += from._dcCodeLengths[i];
+                into._acCodeLengths[i] += from._acCodeLengths[i];
+            }
+            for (size_t i = 0; i < into._dcMagnitudes.size(); i++) {
+                into._dcMagnitudes[i] += from._dcMagnitudes[i];
+                into._acMagnitudes[i] += from._acMagnitudes[i];
+            }
+            for (size_t i = 0; i < into._eobPositions.size(); i++) {
+                into._eobPositions[i] += from._eobPositions[i];
+            }
+            into._blocks += from._blocks;
+        }
+        _bitsPerMCURow.insert(_bitsPerMCURow.end(), other._bitsPerMCURow.begin(), other._bitsPerMCURow.end());
+    }
+};
+
+}
+
+#endif /* decodestats_hpp */
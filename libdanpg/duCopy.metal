@@ -8,17 +8,53 @@
 #include <metal_stdlib>
 using namespace metal;
 
-kernel void copyLumaToImage(device const int* imgCompData, device int4* imageData, uint2 location [[thread_position_in_grid]], uint2 gridSize [[threads_per_grid]]) {
+//component planes are padded to whole MCUs with a row stride, the grid is the
+//image size so the padding is cropped here
+
+kernel void copyLumaToImage(device const int* imgCompData, device int4* imageData, constant uint& stride [[buffer(2)]], uint2 location [[thread_position_in_grid]], uint2 gridSize [[threads_per_grid]]) {
+    
+    imageData[location.y * gridSize.x + location.x].x = imgCompData[location.y * stride + location.x];
+}
+
+kernel void copyGreyscaleToImage(device const int* imgCompData, device int4* imageData, constant uint& stride [[buffer(2)]], uint2 location [[thread_position_in_grid]], uint2 gridSize [[threads_per_grid]]) {
+    
+    imageData[location.y * gridSize.x + location.x] = int4(imgCompData[location.y * stride + location.x], 0, 0, 0);
+}
+
+//luma only output, level shifted and clamped into an 8 bit plane
+kernel void copyLumaToPlane(device const int* imgCompData, device uchar* planeData, constant uint& stride [[buffer(2)]], uint2 location [[thread_position_in_grid]], uint2 gridSize [[threads_per_grid]]) {
+    
+    planeData[location.y * gridSize.x + location.x] = uchar(clamp(imgCompData[location.y * stride + location.x] + 128, 0, 255));
+}
+
+//H and V are the image pixels covered by each chroma sample, Channel is 1 for Cb and 2 for Cr
+template<int Channel, uint H, uint V>
+kernel void copyChroma(device const int* imgCompData, device int4* imageData, constant uint& stride [[buffer(2)]], uint2 location [[thread_position_in_grid]], uint2 gridSize [[threads_per_grid]]) {
     
-    imageData[location.y * gridSize.x + location.x].x = imgCompData[location.y * gridSize.x + location.x];
+    imageData[location.y * gridSize.x + location.x][Channel] = imgCompData[(location.y / V) * stride + (location.x / H)];
 }
 
-kernel void copyChromaBlue(device const int* imgCompData, device int4* imageData, uint2 location [[thread_position_in_grid]], uint2 gridSize [[threads_per_grid]]) {
+#define INSTANTIATE_COPY_CHROMA(name, channel, h, v) \
+template [[host_name(name)]] kernel void copyChroma<channel, h, v>(device const int* imgCompData, device int4* imageData, constant uint& stride [[buffer(2)]], uint2 location [[thread_position_in_grid]], uint2 gridSize [[threads_per_grid]]);
+
+INSTANTIATE_COPY_CHROMA("copyChromaBlue_1x1", 1, 1, 1)
+INSTANTIATE_COPY_CHROMA("copyChromaRed_1x1", 2, 1, 1)
+INSTANTIATE_COPY_CHROMA("copyChromaBlue_2x1", 1, 2, 1)
+INSTANTIATE_COPY_CHROMA("copyChromaRed_2x1", 2, 2, 1)
+INSTANTIATE_COPY_CHROMA("copyChromaBlue_1x2", 1, 1, 2)
+INSTANTIATE_COPY_CHROMA("copyChromaRed_1x2", 2, 1, 2)
+INSTANTIATE_COPY_CHROMA("copyChromaBlue_2x2", 1, 2, 2)
+INSTANTIATE_COPY_CHROMA("copyChromaRed_2x2", 2, 2, 2)
+INSTANTIATE_COPY_CHROMA("copyChromaBlue_4x1", 1, 4, 1)
+INSTANTIATE_COPY_CHROMA("copyChromaRed_4x1", 2, 4, 1)
+
+//generic fallbacks for layouts without a specialisation above
+kernel void copyChromaBlue(device const int* imgCompData, device int4* imageData, constant uint& stride [[buffer(2)]], constant uint2& pixelsPerSample [[buffer(3)]], uint2 location [[thread_position_in_grid]], uint2 gridSize [[threads_per_grid]]) {
     
-    imageData[location.y * gridSize.x + location.x].y = imgCompData[(location.y / 2) * (gridSize.x / 2) + (location.x / 2)];
+    imageData[location.y * gridSize.x + location.x].y = imgCompData[(location.y / pixelsPerSample.y) * stride + (location.x / pixelsPerSample.x)];
 }
 
-kernel void copyChromaRed(device const int* imgCompData, device int4* imageData, uint2 location [[thread_position_in_grid]], uint2 gridSize [[threads_per_grid]]) {
+kernel void copyChromaRed(device const int* imgCompData, device int4* imageData, constant uint& stride [[buffer(2)]], constant uint2& pixelsPerSample [[buffer(3)]], uint2 location [[thread_position_in_grid]], uint2 gridSize [[threads_per_grid]]) {
     
-    imageData[location.y * gridSize.x + location.x].z = imgCompData[(location.y / 2) * (gridSize.x / 2) + (location.x / 2)];
+    imageData[location.y * gridSize.x + location.x].z = imgCompData[(location.y / pixelsPerSample.y) * stride + (location.x / pixelsPerSample.x)];
 }
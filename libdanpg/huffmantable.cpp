@@ -9,6 +9,7 @@
 
 #include <sstream>
 #include <cassert>
+#include <cstring>
 
 HuffmanTable HuffmanTable::build(std::span<uint8_t> data) {
     size_t codeCount = 0;
@@ -94,19 +95,149 @@ HuffmanTable HuffmanTable::build(std::span<uint8_t> data) {
     return table;
 }
 
+void HuffmanTable::buildMultiSymbol() {
+    _multiSymbol.assign(size_t(1) << multiSymbolBits, {});
+    
+    for (size_t window = 0; window < _multiSymbol.size(); window++) {
+        auto& entry = _multiSymbol[window];
+        size_t used = 0;
+        while (entry._count < multiSymbolMax) {
+            size_t remaining = multiSymbolBits - used;
+            //the bits after the window read as zero, so check the code fits
+            auto code = _hufflist[(window << (16 - remaining)) & 0xFFFF];
+            if (code.size == 0 || code.size > remaining) {
+                break;
+            }
+            
+            uint8_t run = code.val >> 4;
+            uint8_t ssss = code.val & 0x0F;
+            if (ssss == 0 && code.val != 0x00 && code.val != 0xF0) {
+                //not a baseline symbol, left to the one symbol decode
+                break;
+            }
+            if (code.size + ssss > remaining) {
+                break;
+            }
+            
+            int16_t value = 0;
+            if (ssss) {
+                int magnitude = (window >> (remaining - code.size - ssss)) & ((1 << ssss) - 1);
+                //extend, f.2.2.1
+                value = magnitude < (1 << (ssss - 1)) ? magnitude - (1 << ssss) + 1 : magnitude;
+            }
+            
+            used += code.size + ssss;
+            entry._bits[entry._count] = used;
+            entry._run[entry._count] = code.val == 0x00 ? multiSymbolEOB : run;
+            entry._value[entry._count] = value;
+            entry._count++;
+            
+            if (code.val == 0x00) {
+                //the next bits belong to another block
+                break;
+            }
+        }
+    }
+}
+
+UnstuffedScan unstuffScan(std::span<const uint8_t> scan) {
+    UnstuffedScan unstuffed;
+    unstuffed._data.resize(scan.size());
+    uint8_t* out = unstuffed._data.data();
+    
+    //memchr is vectorised, so runs without an 0xff are copied at memory speed
+    size_t position = 0;
+    while (position < scan.size()) {
+        auto found = static_cast<const uint8_t*>(std::memchr(&scan[position], 0xff, scan.size() - position));
+        size_t runEnd = found ? found - scan.data() : scan.size();
+        std::memcpy(out, &scan[position], runEnd - position);
+        out += runEnd - position;
+        position = runEnd;
+        
+        if (!found) {
+            break;
+        }
+        
+        if (position + 1 >= scan.size()) {
+            //truncated, decode what there is
+            break;
+        }
+        
+        auto markerByte = scan[position + 1];
+        if (markerByte == 0x00) {
+            *out++ = 0xff;
+            position += 2;
+        } else if (markerByte >= 0xD0 && markerByte <= 0xD7) {
+            position += 2;
+            unstuffed._restartOffsets.push_back(out - unstuffed._data.data());
+        } else if (markerByte == 0xff) {
+            //fill byte ahead of a marker
+            position++;
+        } else {
+            break;
+        }
+    }
+    
+    unstuffed._data.resize(out - unstuffed._data.data());
+    unstuffed._scanBytes = position;
+    return unstuffed;
+}
+
+const char* decodeErrorMessage(DecodeError error) {
+    switch (error) {
+        case DecodeError::None:
+            return "no error";
+        case DecodeError::HuffmanCode:
+            return "huffman error";
+        case DecodeError::OutOfData:
+            return "not enough bytes for request";
+        case DecodeError::Syntax:
+            return "syntax error";
+    }
+    return "unknown error";
+}
+
 void BitDecoder::setTable(HuffmanTable *table) {
     _table = table;
 }
 
-void BitDecoder::setData(std::span<uint8_t> data) {
+void BitDecoder::setData(std::span<const uint8_t> data) {
     _data = data;
 }
 
+void BitDecoder::setUnstuffedData(const UnstuffedScan& scan) {
+    _data = scan._data;
+    _restartOffsets = scan._restartOffsets;
+    _nextRestart = 0;
+    _unstuffed = true;
+}
+
 size_t BitDecoder::position() const {
     return _position;
 }
 
+size_t BitDecoder::bitsRead() const {
+    return _position * 8 - _bitsBuffered;
+}
+
 void BitDecoder::reset() {
+    if (_unstuffed && _nextRestart < _restartOffsets.size()) {
+        //anything read ahead belongs to the next interval, start it afresh
+        _position = _restartOffsets[_nextRestart++];
+    } else if (!_unstuffed && !_markerEncountered) {
+        //the interval's padding bits weren't read ahead as far as its RSTn.
+        //skip to just past it rather than reading the marker as data.
+        while (_position + 1 < _data.size()) {
+            if (_data[_position] == 0xFF && _data[_position + 1] != 0x00) {
+                if (_data[_position + 1] >= 0xD0 && _data[_position + 1] <= 0xD7) {
+                    _position += 2;
+                }
+                break;
+            }
+            _position++;
+        }
+    }
+    
     _bitsIntoByte = 0;
     _bitsBuffered = 0;
     _currentBytes = 0;
@@ -117,11 +248,45 @@ bool BitDecoder::markerEncountered() {
     return _markerEncountered;
 }
 
+void BitDecoder::fail(DecodeError error) {
+    if (_error == DecodeError::None) {
+        _error = error;
+    }
+}
+
+BitDecoder::BitPosition BitDecoder::bitPosition() const {
+    size_t position = _position;
+    
+    //a restart marker read ahead of the bits still buffered is read again after seeking
+    if (_markerEncountered && position >= 2 && _data[position - 2] == 0xFF && _data[position - 1] >= 0xD0 && _data[position - 1] <= 0xD7) {
+        position -= 2;
+    }
+    
+    //step back over the bytes that still have bits buffered, a stuffed 0xff
+    //is two bytes of data. 0x00 after 0xff is only ever stuffing.
+    for (size_t bytes = (_bitsBuffered + 7) / 8; bytes > 0; bytes--) {
+        position -= position >= 2 && _data[position - 1] == 0x00 && _data[position - 2] == 0xFF ? 2 : 1;
+    }
+    
+    return {position, static_cast<uint8_t>((8 - _bitsBuffered % 8) % 8)};
+}
+
+void BitDecoder::seek(BitPosition position) {
+    _position = position._byte;
+    _bitsIntoByte = 0;
+    _bitsBuffered = 0;
+    _currentBytes = 0;
+    _markerEncountered = false;
+    nextXBits(position._bit);
+}
+
 uint8_t BitDecoder::nextHuffmanByte() {
     uint16_t potentialCode = peakXBits(16);
     auto entry = _table->_hufflist[potentialCode];
     if (entry.size == 0) {
-        throw std::runtime_error("huffman error");
+        //zero is EOB and a zero length DC diff, so the block ends cleanly
+        fail(DecodeError::HuffmanCode);
+        return 0;
     }
     
     nextXBits(entry.size);
@@ -134,12 +299,12 @@ uint16_t BitDecoder::nextXBits(size_t bits) {
     bufferBits(bits, true);
     
     if (bits > _bitsBuffered) {
-        throw std::runtime_error("Not enough bytes for request");
+        fail(DecodeError::OutOfData);
+        return 0;
     }
     
-    uint16_t requestedBits = _currentBytes >> (_bitsBuffered - bits);
-    _currentBytes = static_cast<uint32_t>(static_cast<uint64_t>(_currentBytes) << (32 - _bitsBuffered + bits));
-    _currentBytes = _currentBytes >> (32 - (_bitsBuffered - bits));
+    //bits above those buffered are stale, mask them off rather than clearing
+    uint16_t requestedBits = (_currentBytes >> (_bitsBuffered - bits)) & ((1u << bits) - 1);
     _bitsBuffered -= bits;
     return requestedBits;
 }
@@ -150,10 +315,10 @@ uint16_t BitDecoder::peakXBits(size_t bits) {
     bufferBits(bits, false);
     
     if (_bitsBuffered > bits) {
-        uint16_t requestedBits = _currentBytes >> (_bitsBuffered - bits);
+        uint16_t requestedBits = (_currentBytes >> (_bitsBuffered - bits)) & ((1u << bits) - 1);
         return requestedBits;
     } else {
-        uint16_t requestedBits = _currentBytes << (bits - _bitsBuffered);
+        uint16_t requestedBits = (_currentBytes << (bits - _bitsBuffered)) & ((1u << bits) - 1);
         return requestedBits;
     }
 }
@@ -165,11 +330,39 @@ void BitDecoder::bufferBits(size_t bits, bool reading) {
         return;
     }
     
+    if (_unstuffed) {
+        //no stuffing or markers left, so top up with whole bytes from one
+        //big endian load instead of checking each byte
+        if (_bitsBuffered >= bits) {
+            return;
+        }
+        
+        if (_position + 8 <= _data.size()) {
+            uint64_t word;
+            std::memcpy(&word, &_data[_position], sizeof(word));
+            word = __builtin_bswap64(word);
+            
+            size_t bytes = (63 - _bitsBuffered) / 8;
+            _currentBytes = (_currentBytes << (bytes * 8)) | (word >> (64 - bytes * 8));
+            _bitsBuffered += bytes * 8;
+            _position += bytes;
+            return;
+        }
+        
+        while (_bitsBuffered <= 56 && _position < _data.size()) {
+            _currentBytes = (_currentBytes << 8) | _data[_position++];
+            _bitsBuffered += 8;
+        }
+        return;
+    }
+    
     while (_bitsBuffered < bits && _position < _data.size()) {
         auto nextByte = _data[_position++];
         if (nextByte == 0xFF) {
             if (_position >= _data.size()) {
-                throw std::runtime_error("Marker segment with no other byte");
+                //truncated marker, whatever is buffered is all there is
+                _markerEncountered = true;
+                break;
             }
             
             auto markerByte = _data[_position++];
@@ -178,7 +371,10 @@ void BitDecoder::bufferBits(size_t bits, bool reading) {
                 _markerEncountered = true;
                 break;
             } else if (markerByte != 0x00) { //byte stuffing, F.1.2.3. throw this away.
-                throw std::runtime_error("");
+                //any other marker ends the scan, leave it for the segment parser
+                _position -= 2;
+                _markerEncountered = true;
+                break;
             }
         }
         
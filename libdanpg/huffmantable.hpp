@@ -29,31 +29,88 @@ public:
     };
     
     std::array<HuffEntry, 65536> _hufflist;
+    
+    //ac tables only. every coefficient whose code and magnitude bits both fit
+    //in the next multiSymbolBits, up to multiSymbolMax of them, so the common
+    //short codes cost one lookup and one read between them
+    static constexpr size_t multiSymbolBits = 11;
+    static constexpr size_t multiSymbolMax = 3;
+    static constexpr uint8_t multiSymbolEOB = 0xFF;
+    
+    struct MultiSymbolEntry {
+        uint8_t _count; //0 when the first code doesn't fit, decode it one symbol at a time
+        std::array<uint8_t, multiSymbolMax> _bits; //used up to the end of each symbol
+        std::array<uint8_t, multiSymbolMax> _run; //zeros before each coefficient, or multiSymbolEOB
+        std::array<int16_t, multiSymbolMax> _value; //extended, zero for ZRL
+    };
+    
+    //empty until buildMultiSymbol
+    std::vector<MultiSymbolEntry> _multiSymbol;
         
     static HuffmanTable build(std::span<uint8_t> data);
+    void buildMultiSymbol();
 };
 
-class ResetMarkerException : public std::exception {
-    
+//scan entropy data with the byte stuffing removed, F.1.2.3, and where each
+//restart interval starts, so the bit reader never has to look for markers
+struct UnstuffedScan {
+    std::vector<uint8_t> _data;
+    std::vector<size_t> _restartOffsets; //into _data, one per RSTn
+    size_t _scanBytes = 0; //stuffed bytes up to the marker that ends the scan
+};
+
+UnstuffedScan unstuffScan(std::span<const uint8_t> scan);
+
+//entropy decode errors are recorded instead of thrown so bad input stays
+//cheap. the first error sticks and callers check for it once per MCU.
+enum class DecodeError : uint8_t {
+    None,
+    HuffmanCode, //no code in the table matches the next bits
+    OutOfData, //the scan ended before a read could be satisfied
+    Syntax, //a decoded value that F.2.2 doesn't allow
 };
 
+const char* decodeErrorMessage(DecodeError error);
+
 class BitDecoder {
 private:
     HuffmanTable* _table = nullptr;
-    std::span<uint8_t> _data;
+    std::span<const uint8_t> _data;
     size_t _position = 0;
     
+    //unstuffed data has no markers left, restarts jump through the side table
+    bool _unstuffed = false;
+    std::span<const size_t> _restartOffsets;
+    size_t _nextRestart = 0;
+    
     uint32_t _bitsIntoByte = 0;
     uint32_t _bitsBuffered = 0;
-    uint32_t _currentBytes = 0;
+    uint64_t _currentBytes = 0;
     bool _markerEncountered = false;
+    DecodeError _error = DecodeError::None;
     
 public:
     void setTable(HuffmanTable* table);
-    void setData(std::span<uint8_t> data);
+    void setData(std::span<const uint8_t> data);
+    void setUnstuffedData(const UnstuffedScan& scan);
     size_t position() const;
+    //bits taken from the data so far, stuffing and markers included
+    size_t bitsRead() const;
     void reset();
     bool markerEncountered();
+    //reset() leaves the error in place, a bad interval fails the scan
+    DecodeError error() const { return _error; }
+    void fail(DecodeError error);
+    
+    //the next bit to be read, as the byte holding it and how many of that
+    //byte's bits have gone. enough to seek back to it over the same data
+    //later. stuffed data only, unstuffed restarts aren't tracked.
+    struct BitPosition {
+        size_t _byte;
+        uint8_t _bit;
+    };
+    BitPosition bitPosition() const;
+    void seek(BitPosition position);
     
     uint8_t nextHuffmanByte();
     uint16_t peakXBits(size_t bits);
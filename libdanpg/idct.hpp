@@ -9,11 +9,26 @@
 #define idct_hpp
 
 #include <array>
+#include <cstddef>
+#include <cstdint>
+#include <numbers>
+#include <type_traits>
 
 namespace image {
 
 typedef std::array<int, 8*8> DataUnit;
 
+enum class IdctVariant {
+    Reference, //idct_float and friends, plain dequantised coefficients
+    Loeffler, //idct_float_loeffler and idct.metal, prescaled fixed point coefficients
+};
+
+//each coefficient is multiplied by its prescale factor and carries this many
+//fractional bits into the transform, which descales once on output
+float idctPrescale(IdctVariant variant, size_t u, size_t v);
+int idctFractionBits(IdctVariant variant);
+const int loefflerFractionBits = 11;
+
 DataUnit idct_float(const DataUnit& du);
 DataUnit idct_float_table(const DataUnit& du);
 DataUnit dct_float_loeffler(const DataUnit& du);
@@ -25,9 +40,214 @@ DataUnit idct_int_table(const DataUnit& du);
 
 std::array<int, 8> loeffler_1d_dct(const std::array<int, 8> in);
 
-inline void loeffler_1d_idct_row(const std::array<int, 8*8>& du, std::array<float, 8*8>& inter, int offset);
-inline void loeffler_1d_idct_col(const std::array<float, 8*8>& du, std::array<int, 8*8>& out, int offset);
+namespace loeffler {
+
+//std::cos isn't constexpr, so the constants come from a taylor series
+//evaluated at compile time in double and rounded once
+constexpr double cosine(double x) {
+    constexpr double twoPi = 2 * std::numbers::pi;
+    while (x > std::numbers::pi) {
+        x -= twoPi;
+    }
+    while (x < -std::numbers::pi) {
+        x += twoPi;
+    }
+    
+    double term = 1;
+    double sum = 1;
+    for (int n = 1; n < 30; n++) {
+        term *= -x * x / ((2 * n - 1) * (2 * n));
+        sum += term;
+    }
+    return sum;
+}
+
+constexpr double sine(double x) {
+    return cosine(x - std::numbers::pi / 2);
+}
+
+//integer transforms multiply by the constant with this many fraction bits
+constexpr int constantBits = 13;
+
+struct Constant {
+    float _float;
+    int32_t _fixed;
+    
+    constexpr Constant(double value) : _float(static_cast<float>(value)), _fixed(static_cast<int32_t>(value * (1 << constantBits) + (value < 0 ? -0.5 : 0.5))) {}
+};
+
+constexpr Constant c1 = cosine(std::numbers::pi / 16);
+constexpr Constant s1 = sine(std::numbers::pi / 16);
+constexpr Constant c3 = cosine(3 * std::numbers::pi / 16);
+constexpr Constant s3 = sine(3 * std::numbers::pi / 16);
+constexpr Constant r2c1 = std::numbers::sqrt2 * cosine(std::numbers::pi / 16);
+constexpr Constant r2s1 = std::numbers::sqrt2 * sine(std::numbers::pi / 16);
+constexpr Constant r2c6 = std::numbers::sqrt2 * cosine(6 * std::numbers::pi / 16);
+constexpr Constant r2s6 = std::numbers::sqrt2 * sine(6 * std::numbers::pi / 16);
+constexpr Constant r2 = std::numbers::sqrt2;
+
+//float multiplies directly. integers widen so the fixed point product can't
+//overflow, then round back to the element type.
+template<typename T>
+inline T multiply(T value, Constant constant) {
+    if constexpr (std::is_floating_point_v<T>) {
+        return value * constant._float;
+    } else {
+        using Wide = std::conditional_t<sizeof(T) <= 2, int32_t, int64_t>;
+        return static_cast<T>((static_cast<Wide>(value) * constant._fixed + (Wide(1) << (constantBits - 1))) >> constantBits);
+    }
+}
+
+//the output of the column pass, truncated toward zero as the float cast does
+template<typename T, int DescaleBits>
+inline int descale(T value) {
+    if constexpr (std::is_floating_point_v<T>) {
+        constexpr T scale = T(1) / (1 << DescaleBits);
+        return static_cast<int>(value * scale);
+    } else {
+        return static_cast<int>(value / (T(1) << DescaleBits));
+    }
+}
+
+}
 
+//one row of the 2d transform, into intermediates of T. float, or int32_t and
+//int16_t fixed point, where an int16_t transform needs coefficients with
+//few enough fraction bits that the row sums fit.
+template<typename T>
+inline void loeffler_1d_idct_row(const DataUnit& du, std::array<T, 8*8>& inter, int offset) {
+    using namespace loeffler;
+    
+    ///
+    //stage4
+    ///
+    std::array<T, 8> stage4;
+    stage4[0] = du[0 + offset];
+    stage4[1] = du[4 + offset];
+    stage4[2] = du[2 + offset];
+    stage4[3] = du[6 + offset];
+    stage4[4] = du[1 + offset] - du[7 + offset];
+    stage4[5] = du[3 + offset];
+    stage4[6] = du[5 + offset];
+    stage4[7] = du[1 + offset] + du[7 + offset];
+    
+    ///
+    //stage3
+    ///
+    std::array<T, 8> stage3;
+    stage3[0] = stage4[0] + stage4[1];
+    stage3[1] = stage4[0] - stage4[1];
+    stage3[2] = multiply(stage4[2], r2c6) - multiply(stage4[3], r2s6);
+    stage3[3] = multiply(stage4[2], r2s6) + multiply(stage4[3], r2c6);
+    stage3[4] = stage4[4] + stage4[6];
+    stage3[5] = stage4[7] - stage4[5];
+    stage3[6] = stage4[4] - stage4[6];
+    stage3[7] = stage4[7] + stage4[5];
+    
+    ///
+    //stage 2
+    ///
+    std::array<T, 8> stage2;
+    stage2[0] = stage3[0] + stage3[3];
+    stage2[1] = stage3[1] + stage3[2];
+    stage2[2] = stage3[1] - stage3[2];
+    stage2[3] = stage3[0] - stage3[3];
+    //stage 2, c3
+    stage2[4] = multiply(stage3[4], c3) - multiply(stage3[7], s3);
+    stage2[7] = multiply(stage3[4], s3) + multiply(stage3[7], c3);
+    //stage 2, c1
+    stage2[5] = multiply(stage3[5], c1) - multiply(stage3[6], s1);
+    stage2[6] = multiply(stage3[5], s1) + multiply(stage3[6], c1);
+    
+    ///
+    //stage 1
+    ///
+    inter[0 + offset] = stage2[0] + stage2[7];
+    inter[1 + offset] = stage2[1] + stage2[6];
+    inter[2 + offset] = stage2[2] + stage2[5];
+    inter[3 + offset] = stage2[3] + stage2[4];
+    inter[4 + offset] = stage2[3] - stage2[4];
+    inter[5 + offset] = stage2[2] - stage2[5];
+    inter[6 + offset] = stage2[1] - stage2[6];
+    inter[7 + offset] = stage2[0] - stage2[7];
+}
+
+//one column, descaled by DescaleBits fraction bits on the way out
+template<typename T, int DescaleBits>
+inline void loeffler_1d_idct_col(const std::array<T, 8*8>& inter, DataUnit& out, int offset) {
+    using namespace loeffler;
+    
+    ///
+    //stage4
+    ///
+    std::array<T, 8> stage4;
+    stage4[0] = inter[0 + offset];
+    stage4[1] = inter[32 + offset];
+    stage4[2] = inter[16 + offset];
+    stage4[3] = inter[48 + offset];
+    stage4[4] = inter[8 + offset] - inter[56 + offset];
+    stage4[5] = inter[24 + offset];
+    stage4[6] = inter[40 + offset];
+    stage4[7] = inter[8 + offset] + inter[56 + offset];
+    
+    ///
+    //stage3
+    ///
+    std::array<T, 8> stage3;
+    stage3[0] = stage4[0] + stage4[1];
+    stage3[1] = stage4[0] - stage4[1];
+    stage3[2] = multiply(stage4[2], r2c6) - multiply(stage4[3], r2s6);
+    stage3[3] = multiply(stage4[2], r2s6) + multiply(stage4[3], r2c6);
+    stage3[4] = stage4[4] + stage4[6];
+    stage3[5] = stage4[7] - stage4[5];
+    stage3[6] = stage4[4] - stage4[6];
+    stage3[7] = stage4[7] + stage4[5];
+    
+    ///
+    //stage 2
+    ///
+    std::array<T, 8> stage2;
+    stage2[0] = stage3[0] + stage3[3];
+    stage2[1] = stage3[1] + stage3[2];
+    stage2[2] = stage3[1] - stage3[2];
+    stage2[3] = stage3[0] - stage3[3];
+    //stage 2, c3
+    stage2[4] = multiply(stage3[4], c3) - multiply(stage3[7], s3);
+    stage2[7] = multiply(stage3[4], s3) + multiply(stage3[7], c3);
+    //stage 2, c1
+    stage2[5] = multiply(stage3[5], c1) - multiply(stage3[6], s1);
+    stage2[6] = multiply(stage3[5], s1) + multiply(stage3[6], c1);
+    
+    ///
+    //stage 1
+    ///
+    out[0*8 + offset] = descale<T, DescaleBits>(stage2[0] + stage2[7]);
+    out[1*8 + offset] = descale<T, DescaleBits>(stage2[1] + stage2[6]);
+    out[2*8 + offset] = descale<T, DescaleBits>(stage2[2] + stage2[5]);
+    out[3*8 + offset] = descale<T, DescaleBits>(stage2[3] + stage2[4]);
+    out[4*8 + offset] = descale<T, DescaleBits>(stage2[3] - stage2[4]);
+    out[5*8 + offset] = descale<T, DescaleBits>(stage2[2] - stage2[5]);
+    out[6*8 + offset] = descale<T, DescaleBits>(stage2[1] - stage2[6]);
+    out[7*8 + offset] = descale<T, DescaleBits>(stage2[0] - stage2[7]);
+}
+
+//the 2d transform in place. each instantiation is straight line code with its
+//constants as immediates. coefficients carry DescaleBits fraction bits, as
+//dequantisationTable gives loefflerFractionBits for IdctVariant::Loeffler.
+template<typename T, int DescaleBits = loefflerFractionBits>
+inline void idct_loeffler(DataUnit& du) {
+    std::array<T, 8*8> intermediate;
+    
+    //rows
+    for (int y = 0; y < 64; y+=8) {
+        loeffler_1d_idct_row(du, intermediate, y);
+    }
+    
+    //columns
+    for (int x = 0; x < 8; x++) {
+        loeffler_1d_idct_col<T, DescaleBits>(intermediate, du, x);
+    }
+}
 
 }
 
@@ -8,22 +8,24 @@
 #include <metal_stdlib>
 using namespace metal;
 
+//coefficients arrive prescaled with loefflerFractionBits (idct.hpp) of fixed point
+constant float descale = 1.f / (1 << 11);
+
 void copyImgCmpDataToIntermediate(device const int* in, thread int* out, int span);
 void copyIntermediateToImgCmpData(thread const int* in, device int* out, int span);
 void loeffler_1d_idct_row(thread const int* in, thread float* inter, int offset);
 void loeffler_1d_idct_col(thread float* in, thread int* out, int offset);
 
-kernel void idct(device int* imgCompData, uint2 location [[thread_position_in_grid]], uint2 gridSize [[threads_per_grid]]) {
+kernel void idct(device int* imgCompData, constant uint& stride [[buffer(1)]], uint2 location [[thread_position_in_grid]]) {
     int du[8*8];
     float intermediate[8*8];
     
     int imgLocX = location.x * 8;
     int imgLocY = location.y * 8;
-    int imgWidth = gridSize.x * 8;
     
-    int startPosition = imgLocX + imgLocY * imgWidth;
+    int startPosition = imgLocX + imgLocY * stride;
     
-    copyImgCmpDataToIntermediate(imgCompData + startPosition, du, imgWidth);
+    copyImgCmpDataToIntermediate(imgCompData + startPosition, du, stride);
     
     //IDCT Row
     for (int y = 0; y < 8; y++) {
@@ -35,7 +37,7 @@ kernel void idct(device int* imgCompData, uint2 location [[thread_position_in_gr
         loeffler_1d_idct_col(intermediate, du, x);
     }
     
-    copyIntermediateToImgCmpData(du, imgCompData + startPosition, imgWidth);
+    copyIntermediateToImgCmpData(du, imgCompData + startPosition, stride);
 }
 
 void copyImgCmpDataToIntermediate(device const int* imgCompData, thread int* du, int width) {
@@ -64,8 +66,8 @@ void loeffler_1d_idct_row(thread const int* in, thread float* inter, int offset)
     stage4[2] = in[2 + offset];
     stage4[3] = in[6 + offset];
     stage4[4] = in[1 + offset] - in[7 + offset];
-    stage4[5] = in[3 + offset] * sqrt(2.f);
-    stage4[6] = in[5 + offset] * sqrt(2.f);
+    stage4[5] = in[3 + offset];
+    stage4[6] = in[5 + offset];
     stage4[7] = in[1 + offset] + in[7 + offset];
     
     ///
@@ -126,8 +128,8 @@ void loeffler_1d_idct_col(thread float* in, thread int* out, int offset) {
     stage4[2] = in[16 + offset];
     stage4[3] = in[48 + offset];
     stage4[4] = in[8 + offset] - in[56 + offset];
-    stage4[5] = in[24 + offset] * sqrt(2.f);
-    stage4[6] = in[40 + offset] * sqrt(2.f);
+    stage4[5] = in[24 + offset];
+    stage4[6] = in[40 + offset];
     stage4[7] = in[8 + offset] + in[56 + offset];
     
     ///
@@ -167,12 +169,12 @@ void loeffler_1d_idct_col(thread float* in, thread int* out, int offset) {
     ///
     //stage 1
     ///
-    out[0*8 + offset] = (stage2[0] + stage2[7]) / 8.f;
-    out[1*8 + offset] = (stage2[1] + stage2[6]) / 8.f;
-    out[2*8 + offset] = (stage2[2] + stage2[5]) / 8.f;
-    out[3*8 + offset] = (stage2[3] + stage2[4]) / 8.f;
-    out[4*8 + offset] = (stage2[3] - stage2[4]) / 8.f;
-    out[5*8 + offset] = (stage2[2] - stage2[5]) / 8.f;
-    out[6*8 + offset] = (stage2[1] - stage2[6]) / 8.f;
-    out[7*8 + offset] = (stage2[0] - stage2[7]) / 8.f;
+    out[0*8 + offset] = (stage2[0] + stage2[7]) * descale;
+    out[1*8 + offset] = (stage2[1] + stage2[6]) * descale;
+    out[2*8 + offset] = (stage2[2] + stage2[5]) * descale;
+    out[3*8 + offset] = (stage2[3] + stage2[4]) * descale;
+    out[4*8 + offset] = (stage2[3] - stage2[4]) * descale;
+    out[5*8 + offset] = (stage2[2] - stage2[5]) * descale;
+    out[6*8 + offset] = (stage2[1] - stage2[6]) * descale;
+    out[7*8 + offset] = (stage2[0] - stage2[7]) * descale;
 }
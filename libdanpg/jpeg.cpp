@@ -8,7 +8,10 @@
 #include "jpeg.hpp"
 
 #include "colour.hpp"
+#include "idct.hpp"
+#include "probe.hpp"
 
+#include <algorithm>
 #include <cstddef>
 #include <iostream>
 #include <bit>
@@ -19,8 +22,11 @@
 #include <strstream>
 #include <cassert>
 #include <cstring>
+#include <utility>
+#include <thread>
 
 #include <arpa/inet.h>
+#include <unistd.h>
 
 #include <Foundation/Foundation.hpp>
 #include <Metal/Metal.hpp>
@@ -35,9 +41,95 @@ T getAs(void* data) {
     return *reinterpret_cast<T*>(data);
 }
 
+const size_t planeRowAlignment = 64;
+
+size_t roundUp(size_t value, size_t multiple) {
+    return (value + multiple - 1) / multiple * multiple;
+}
+
+//planes are wrapped with no-copy metal buffers, which need page aligned memory
+size_t planeAlignment() {
+    static const size_t pageSize = static_cast<size_t>(getpagesize());
+    return pageSize;
+}
+
+size_t planeBytes(const Jpeg::ImageComponent& ic) {
+    return roundUp(ic._stride * ic._rows * sizeof(int), planeAlignment());
+}
+
+size_t imageBytes(const Jpeg& jpeg) {
+    return roundUp(static_cast<size_t>(jpeg._x) * jpeg._y * sizeof(Colour), planeRowAlignment);
+}
+
+size_t lumaImageBytes(const Jpeg& jpeg) {
+    return roundUp(static_cast<size_t>(jpeg._x) * jpeg._y, planeAlignment());
+}
+
+}
+
+Jpeg::Jpeg(std::span<uint8_t> is, MTL::Device* metalDevice, size_t pipelineThreads, OutputMode outputMode) : _metalDevice(metalDevice), _outputMode(outputMode), _pipelineThreads(pipelineThreads) {
+    decode(is);
+}
+
+Jpeg::Jpeg(std::span<uint8_t> is, Destination destination, MTL::Device* metalDevice, size_t pipelineThreads) : _metalDevice(metalDevice), _destination(destination), _pipelineThreads(pipelineThreads) {
+    if (!_destination._data) {
+        throw std::logic_error("destination has no pixel data");
+    }
+    
+    if (_destination._format == PixelFormat::Grey8) {
+        _outputMode = OutputMode::Luma;
+    }
+    
+    decode(is);
+}
+
+Jpeg::Jpeg(std::span<uint8_t> is, TensorOutput tensor, MTL::Device* metalDevice, size_t pipelineThreads) : _metalDevice(metalDevice), _tensor(tensor), _pipelineThreads(pipelineThreads) {
+    if (!_tensor._data) {
+        throw std::logic_error("tensor has no data");
+    }
+    
+    decode(is);
+}
+
+Jpeg::Jpeg() {
+    
+}
+
+Jpeg::~Jpeg() {
+    releaseImage();
+}
+
+DecodedImage image::decodeImage(std::span<uint8_t> data, const DecodeOptions& options) {
+    //tables and parser state stay on the heap and go as soon as the scan is done
+    auto jpeg = std::make_unique<Jpeg>();
+    jpeg->_metalDevice = options._metalDevice;
+    jpeg->_pipelineThreads = options._pipelineThreads;
+    jpeg->_outputMode = options._outputMode;
+    jpeg->_unstuffScan = options._unstuffScan;
+    jpeg->_multiSymbolAC = options._multiSymbolAC;
+    jpeg->_logSegments = options._logSegments;
+    jpeg->_allocator = options._allocator;
+    jpeg->decode(data);
+    return jpeg->takeImage();
 }
 
-Jpeg::Jpeg(std::span<uint8_t> is, MTL::Device* metalDevice) : _metalDevice(metalDevice) {
+DecodedImage image::decodeThumbnail(std::span<uint8_t> data, size_t minWidth, size_t minHeight, const DecodeOptions& options) {
+    auto thumbnail = exifThumbnail(data, probe(data));
+    if (!thumbnail.empty()) {
+        auto info = probe(thumbnail);
+        if (info.valid() && info._baseline && info._width >= minWidth && info._height >= minHeight) {
+            auto decoded = decodeImage(data.subspan(thumbnail.data() - data.data(), thumbnail.size()), options);
+            if (decoded && decoded._error == DecodeError::None) {
+                return decoded;
+            }
+        }
+    }
+    
+    //there's no scaled decode, so anything else is a full one
+    return decodeImage(data, options);
+}
+
+void Jpeg::decode(std::span<uint8_t> is) {
     size_t position = 0;
     
     while (position < is.size()) {
@@ -50,26 +142,33 @@ Jpeg::Jpeg(std::span<uint8_t> is, MTL::Device* metalDevice) : _metalDevice(metal
     }    
 }
 
-Jpeg::Jpeg() {
-    
-}
-
 size_t Jpeg::readData(std::span<uint8_t> is) {
     uint8_t step = is[0];
     if (step == 0xff) {
         uint8_t markerCode = is[1];
         
         if (markerCode == 0xd8) {
-            std::cout << "\tSOI Start of Image, skipping byte count" << std::endl;
+            if (_logSegments) {
+                std::cout << "\tSOI Start of Image, skipping byte count" << std::endl;
+            }
             return 2;
         }
         
+        if (markerCode == 0xd9) {
+            if (_logSegments) {
+                std::cout << "\tEOI End of Image" << std::endl;
+            }
+            return is.size();
+        }
+        
         uint16_t segmentBytes;
         segmentBytes = *reinterpret_cast<uint16_t*>(&is[2]);
         segmentBytes = htons(segmentBytes);
         segmentBytes -= 2;
         
-        std::cout << "\tSegment has " << segmentBytes << " bytes";
+        if (_logSegments) {
+            std::cout << "\tSegment has " << segmentBytes << " bytes";
+        }
         
         std::span<uint8_t> data(&is[4], segmentBytes);
         
@@ -99,7 +198,9 @@ size_t Jpeg::readData(std::span<uint8_t> is) {
                 break;
                 
             default:
-                std::cout << "\tUnhandled marker segment" << std::endl;
+                if (_logSegments) {
+                    std::cout << "\tUnhandled marker segment" << std::endl;
+                }
                 break;
         }
         
@@ -121,25 +222,107 @@ int extend_op(int v, int t) {
     }
 }
 
+const std::array<uint8_t, 64> zigzagTable = {
+    0,   1,  8, 16,  9,  2,  3, 10,
+    17, 24, 32, 25, 18, 11,  4,  5,
+    12, 19, 26, 33, 40, 48, 41, 34,
+    27, 20, 13,  6,  7, 14, 21, 28,
+    35, 42, 49, 56, 57, 50, 43, 36,
+    29, 22, 15, 23, 30, 37, 44, 51,
+    58, 59, 52, 45, 38, 31, 39, 46,
+    53, 60, 61, 54, 47, 55, 62, 63,
+};
+
 }
 
-Jpeg::DataUnit Jpeg::readBlock(BitDecoder& dec, ImageComponentInScan& ic) {
-    DataUnit du;
-    du.fill(0);
+size_t Jpeg::readBlock(BitDecoder& dec, ImageComponentInScan& ic, int* out, size_t stride) {
+    const auto& dequant = *ic._ic->_dqTable;
     
     //first read the DC component. f.2.2.1
     dec.setTable(ic._tdTable);
+#ifdef DANPG_DECODE_STATS
+    size_t codeLength = ic._tdTable->_hufflist[dec.peakXBits(16)].size;
+#endif
     uint8_t t = dec.nextHuffmanByte();
-    if (t > 15) throw std::runtime_error("syntax error, dc ssss great than 15");
+    if (t > 15) {
+        dec.fail(DecodeError::Syntax); //dc ssss greater than 15
+        return 0;
+    }
     auto diffReceive = dec.nextXBits(t);
     ic.prevDC += ::extend_op(diffReceive, t);
-    du[0] = ic.prevDC * (*ic._ic->_tqTable)[0];
+    out[0] = ic.prevDC * dequant[0];
+#ifdef DANPG_DECODE_STATS
+    if (ic._stats) {
+        ic._stats->_dcCodeLengths[codeLength]++;
+        ic._stats->_dcMagnitudes[t]++;
+    }
+#endif
     
     //read ac coefficients. f.2.2.2
     dec.setTable(ic._taTable);
     size_t k = 0;
+    size_t lastWritten = 0;
+    const auto* multiSymbol = ic._taTable->_multiSymbol.empty() ? nullptr : ic._taTable->_multiSymbol.data();
     do {
+        if (multiSymbol) {
+            const auto& entry = multiSymbol[dec.peakXBits(HuffmanTable::multiSymbolBits)];
+            size_t used = 0;
+            bool blockEnded = false;
+            for (size_t i = 0; i < entry._count; i++) {
+#ifdef DANPG_DECODE_STATS
+                if (ic._stats) {
+                    //the entry only keeps where each symbol ends, the code is what the magnitude didn't use
+                    size_t ssss = std::bit_width(static_cast<unsigned int>(std::abs(entry._value[i])));
+                    size_t symbolStart = i ? entry._bits[i - 1] : 0;
+                    bool counted = entry._run[i] == HuffmanTable::multiSymbolEOB || k + 1 + entry._run[i] <= 63;
+                    if (counted) {
+                        ic._stats->_acCodeLengths[entry._bits[i] - symbolStart - ssss]++;
+                        if (ssss) {
+                            ic._stats->_acMagnitudes[ssss]++;
+                        }
+                    }
+                }
+#endif
+                if (entry._run[i] == HuffmanTable::multiSymbolEOB) {
+                    used = entry._bits[i];
+                    blockEnded = true;
+                    break;
+                }
+                
+                size_t next = k + 1 + entry._run[i];
+                if (next > 63) {
+                    //the one symbol decode reports it, or ends the block after a ZRL
+                    break;
+                }
+                
+                k = next;
+                used = entry._bits[i];
+                if (entry._value[i]) {
+                    auto naturalIndex = zigzagTable[k];
+                    out[(naturalIndex >> 3) * stride + (naturalIndex & 7)] = entry._value[i] * dequant[naturalIndex];
+                    lastWritten = k;
+                }
+                if (k == 63) {
+                    blockEnded = true;
+                    break;
+                }
+            }
+            
+            if (used) {
+                dec.nextXBits(used);
+                if (blockEnded) {
+                    break;
+                }
+                continue;
+            }
+        }
+        
         k++;
+#ifdef DANPG_DECODE_STATS
+        if (ic._stats) {
+            ic._stats->_acCodeLengths[ic._taTable->_hufflist[dec.peakXBits(16)].size]++;
+        }
+#endif
         uint8_t rs = dec.nextHuffmanByte();
         if (rs == 0x00) {
             //EOB. All remaining coefficients are zero.
@@ -147,85 +330,299 @@ Jpeg::DataUnit Jpeg::readBlock(BitDecoder& dec, ImageComponentInScan& ic) {
         }
         else if (rs == 0xF0) {
             //ZRL. Skip 15 zero coefficients and this one is also zero.
-            k += 16;
+            k += 15;
         } else {
             uint8_t r = rs >> 4;
             k += r;
+            if (k > 63) {
+                dec.fail(DecodeError::Syntax); //ac run past end of block
+                break;
+            }
             
             uint8_t ssss = rs & 0x0F;
             auto receive = dec.nextXBits(ssss);
             auto res = extend_op(receive, ssss);
-            du[deZigZag(k)] = res * (*ic._ic->_tqTable)[k];
+            auto naturalIndex = zigzagTable[k];
+            out[(naturalIndex >> 3) * stride + (naturalIndex & 7)] = res * dequant[naturalIndex];
+            lastWritten = k;
+#ifdef DANPG_DECODE_STATS
+            if (ic._stats) {
+                ic._stats->_acMagnitudes[ssss]++;
+            }
+#endif
         }
     } while (k < 63);
     
-    return du;
+#ifdef DANPG_DECODE_STATS
+    if (ic._stats) {
+        ic._stats->_blocks++;
+        ic._stats->_eobPositions[lastWritten]++;
+    }
+#endif
+    return lastWritten;
 }
 
-uint8_t Jpeg::deZigZag(uint8_t index) {
-    const uint8_t zigzagTable[] = {
-        0,   1,  8, 16,  9,  2,  3, 10,
-        17, 24, 32, 25, 18, 11,  4,  5,
-        12, 19, 26, 33, 40, 48, 41, 34,
-        27, 20, 13,  6,  7, 14, 21, 28,
-        35, 42, 49, 56, 57, 50, 43, 36,
-        29, 22, 15, 23, 30, 37, 44, 51,
-        58, 59, 52, 45, 38, 31, 39, 46,
-        53, 60, 61, 54, 47, 55, 62, 63,
-    };
+void Jpeg::skipBlock(BitDecoder& dec, ImageComponentInScan& ic) {
+    dec.setTable(ic._tdTable);
+    uint8_t t = dec.nextHuffmanByte();
+    if (t > 15) {
+        dec.fail(DecodeError::Syntax);
+        return;
+    }
+    dec.nextXBits(t);
     
+    dec.setTable(ic._taTable);
+    size_t k = 0;
+    do {
+        k++;
+        uint8_t rs = dec.nextHuffmanByte();
+        if (rs == 0x00) {
+            break;
+        } else if (rs == 0xF0) {
+            k += 15;
+        } else {
+            k += rs >> 4;
+            if (k > 63) {
+                dec.fail(DecodeError::Syntax);
+                return;
+            }
+            dec.nextXBits(rs & 0x0F);
+        }
+    } while (k < 63);
+}
+
+uint8_t Jpeg::deZigZag(uint8_t index) {
     assert(index < 64);
     
     return zigzagTable[index];
 }
 
+Jpeg::DequantisationTable Jpeg::dequantisationTable(const QuantisationTable& table, IdctVariant variant) {
+    DequantisationTable dequant;
+    const float fixedPoint = static_cast<float>(1 << idctFractionBits(variant));
+    
+    for (size_t k = 0; k < 64; k++) {
+        auto naturalIndex = zigzagTable[k];
+        auto prescale = idctPrescale(variant, naturalIndex % 8, naturalIndex / 8);
+        dequant[naturalIndex] = static_cast<int>(std::lround(table[k] * prescale * fixedPoint));
+    }
+    
+    return dequant;
+}
+
 size_t Jpeg::readScanData(std::span<uint8_t> is) {
     size_t x = 0;
     size_t y = 0;
         
     BitDecoder dec;
-    dec.setData(is);
+    UnstuffedScan unstuffed;
+    if (_unstuffScan) {
+        unstuffed = unstuffScan(is);
+        dec.setUnstuffedData(unstuffed);
+    } else {
+        dec.setData(is);
+    }
     
-    try {
-        size_t position = 0;
-        size_t restartInterval = _numberOfMCU;
-        while (position < is.size()) {
-            const size_t mcuRes = 16;
-            
-            readMCU(dec, x, y);
-            restartInterval--;
-                            
-            x += mcuRes;
-            if (x >= _x) {
-                x = 0;
-                y += mcuRes;
+    const size_t mcusPerLine = (_x + _mcuWidth - 1) / _mcuWidth;
+    const size_t mcuLines = (_y + _mcuHeight - 1) / _mcuHeight;
+    
+    //in pipelined mode completed MCU rows are handed to the transform workers
+    //while the rest of the scan is still being entropy decoded
+    const bool pipelined = !_metalDevice && _pipelineThreads > 0;
+    MCURowQueue rowQueue;
+    std::vector<std::thread> workers;
+    size_t rowsPublished = 0;
+    auto publishRowsUpTo = [&](size_t rows) {
+        for (; rowsPublished < rows; rowsPublished++) {
+            while (!rowQueue.tryPush(rowsPublished)) {
+                std::this_thread::yield();
             }
+        }
+    };
+    
+    if (pipelined) {
+        for (size_t i = 0; i < _pipelineThreads; i++) {
+            workers.emplace_back(&Jpeg::transformWorker, this, std::ref(rowQueue));
+        }
+    }
+    
+    const size_t mcuCount = mcusPerLine * mcuLines;
+    size_t restartInterval = _numberOfMCU;
+#ifdef DANPG_DECODE_STATS
+    size_t rowStartBits = dec.bitsRead();
+#endif
+    for (size_t mcu = 0; mcu < mcuCount; mcu++) {
+        (this->*_mcuDecoder)(dec, x, y);
+        if (dec.error() != DecodeError::None) {
+            //the MCU that failed is left as it was decoded, but not counted
+            _scanError = dec.error();
+            break;
+        }
+        _mcusDecoded++;
+        restartInterval--;
+                        
+        x += _mcuWidth;
+        if (x >= _x) {
+            x = 0;
+            y += _mcuHeight;
+#ifdef DANPG_DECODE_STATS
+            _stats._bitsPerMCURow.push_back(dec.bitsRead() - rowStartBits);
+            rowStartBits = dec.bitsRead();
+#endif
             
-            if (restartInterval == 0) {
-                restartInterval = _numberOfMCU;
-                dec.reset();
-                for (auto& icS : _imageComponentsInScan) {
-                    icS.prevDC = 0;
-                }
+            if (pipelined) {
+                publishRowsUpTo(y / _mcuHeight);
+            }
+        }
+        
+        if (restartInterval == 0) {
+            restartInterval = _numberOfMCU;
+            dec.reset();
+            for (auto& icS : _imageComponentsInScan) {
+                icS.prevDC = 0;
             }
         }
-    } catch (std::exception& e) {
-        std::cout << "readScanData, exception: " << e.what() << std::endl;
     }
     
-    auto commandQueue = NS::TransferPtr(_metalDevice->newCommandQueue());
-    auto commandBuffer = commandQueue->commandBuffer();
-    auto computeEncoder = commandBuffer->computeCommandEncoder();
+    _inScan = false;
+    
+    if (pipelined) {
+        //rows after a decode error are still transformed, as in the other paths
+        publishRowsUpTo(mcuLines);
+        for (size_t i = 0; i < workers.size(); i++) {
+            while (!rowQueue.tryPush(endOfScan)) {
+                std::this_thread::yield();
+            }
+        }
+        
+        for (auto& worker : workers) {
+            worker.join();
+        }
+    } else if (_metalDevice) {
+        auto commandQueue = NS::TransferPtr(_metalDevice->newCommandQueue());
+        auto commandBuffer = commandQueue->commandBuffer();
+        auto computeEncoder = commandBuffer->computeCommandEncoder();
+        
+        idctImgComp(computeEncoder);
+        if (_outputMode == OutputMode::Luma) {
+            copyLumaToPlane(computeEncoder);
+        } else {
+            copyImgCompToImage(computeEncoder);
+            ycbcrToRGB_accel(_metalDevice, computeEncoder, _image, this->_x, this->_y);
+        }
+        
+        computeEncoder->endEncoding();
+        commandBuffer->commit();
+        commandBuffer->waitUntilCompleted();
+        
+        if (_destination._data || _tensor._data) {
+            packImageToOutputs();
+        }
+    } else {
+        for (size_t mcuRow = 0; mcuRow < mcuLines; mcuRow++) {
+            transformMCURow(mcuRow);
+        }
+    }
+    
+    if (_destination._data) {
+        //luma was written straight into the destination, it isn't ours to hand out
+        _lumaImage = nullptr;
+    }
+    
+    return _unstuffScan ? unstuffed._scanBytes : dec.position();
+}
+
+void Jpeg::transformWorker(MCURowQueue& rowQueue) {
+    for (;;) {
+        size_t mcuRow;
+        if (!rowQueue.tryPop(mcuRow)) {
+            std::this_thread::yield();
+            continue;
+        }
+        
+        if (mcuRow == endOfScan) {
+            return;
+        }
+        
+        transformMCURow(mcuRow);
+    }
+}
+
+void Jpeg::transformMCURow(size_t mcuRow) {
+    idctImgComp(mcuRow);
+    if (_outputMode == OutputMode::Luma) {
+        copyLumaToPlane(mcuRow);
+        return;
+    }
+    
+    size_t yStart = mcuRow * _mcuHeight;
+    size_t yEnd = std::min<size_t>(yStart + _mcuHeight, _y);
+    if (_image) {
+        copyImgCompToImage(yStart, yEnd, &_image[yStart * _x]);
+        ycbcrToRGBOverImage(&_image[yStart * _x], _x, yEnd - yStart);
+        return;
+    }
+    
+    //caller owned destination or tensor, only a line of colours is ever held
+    thread_local std::vector<Colour> line;
+    line.resize(_x);
+    for (size_t y = yStart; y < yEnd; y++) {
+        copyImgCompToImage(y, y + 1, line.data());
+        ycbcrToRGBOverImage(line.data(), _x, 1);
+        if (_destination._data) {
+            packPixels(line.data(), _x, _destination._format, &_destination._data[y * _destination._stride]);
+        } else {
+            _tensorWriter.writeLine(line.data(), y);
+        }
+    }
+}
+
+void Jpeg::packImageToOutputs() {
+    for (size_t y = 0; y < _y; y++) {
+        if (_tensor._data) {
+            _tensorWriter.writeLine(&_image[y * _x], y);
+            continue;
+        }
+        
+        auto destinationRow = &_destination._data[y * _destination._stride];
+        if (_outputMode == OutputMode::Luma) {
+            std::memcpy(destinationRow, &_lumaImage[y * _lumaStride], _x);
+        } else {
+            packPixels(&_image[y * _x], _x, _destination._format, destinationRow);
+        }
+    }
     
-    idctImgComp(computeEncoder);
-    copyImgCompToImage(computeEncoder);
-    ycbcrToRGB_accel(_metalDevice, computeEncoder, _image, this->_x, this->_y);
+    releaseImage();
+}
+
+DecodedImage Jpeg::takeImage() {
+    DecodedImage decoded;
+    if (_image) {
+        decoded = DecodedImage(_image, imageBytes(*this), *_allocator, _x, _y, _x * sizeof(Colour), DecodedImage::Format::Colour);
+        _image = nullptr;
+    } else if (_lumaImage && _lumaImage != _destination._data) {
+        decoded = DecodedImage(_lumaImage, lumaImageBytes(*this), *_allocator, _x, _y, _lumaStride, DecodedImage::Format::Grey8);
+        _lumaImage = nullptr;
+    }
     
-    computeEncoder->endEncoding();
-    commandBuffer->commit();
-    commandBuffer->waitUntilCompleted();
+    decoded._error = _scanError;
+#ifdef DANPG_DECODE_STATS
+    decoded._stats = std::move(_stats);
+#endif
+    return decoded;
+}
+
+void Jpeg::releaseImage() {
+    if (_image) {
+        _allocator->deallocate(_image, imageBytes(*this));
+        _image = nullptr;
+    }
     
-    return dec.position();
+    //aliased to the destination until the scan is done, never ours to free
+    if (_lumaImage && _lumaImage != _destination._data) {
+        _allocator->deallocate(_lumaImage, lumaImageBytes(*this));
+    }
+    _lumaImage = nullptr;
 }
 
 void Jpeg::idctImgComp(MTL::ComputeCommandEncoder* commandEncoder) {
@@ -235,16 +632,20 @@ void Jpeg::idctImgComp(MTL::ComputeCommandEncoder* commandEncoder) {
     auto functionPSO = NS::TransferPtr(_metalDevice->newComputePipelineState(function, &error));
         
     for (auto& ic : _imageComponents) {
+        if (!ic._icSubPixelData) {
+            continue;
+        }
         
-        auto icWidth = (_x / ic._hPixelsPerSample);
-        auto icHeight = (_y / ic._vPixelsPerSample);
-        
-        auto bufferImgComponent = NS::TransferPtr(_metalDevice->newBuffer(ic._icSubPixelData.get(), icWidth * icHeight * sizeof(int), MTL::ResourceStorageModeShared, nullptr));
+        auto bufferImgComponent = NS::TransferPtr(_metalDevice->newBuffer(ic._icSubPixelData.get(), planeBytes(ic), MTL::ResourceStorageModeShared, nullptr));
+        const uint32_t stride = static_cast<uint32_t>(ic._stride);
 
         commandEncoder->setComputePipelineState(functionPSO.get());
         commandEncoder->setBuffer(bufferImgComponent.get(), 0, 0);
+        commandEncoder->setBytes(&stride, sizeof(stride), 1);
 
-        auto gridSize = MTL::Size(icWidth / 8, icHeight / 8, 1);
+        //planes are padded to whole MCUs so every block is complete,
+        //the output is cropped to the image by the copy kernels
+        auto gridSize = MTL::Size(ic._width / 8, ic._rows / 8, 1);
         auto threadGroupSizeObj = MTL::Size(1, 1, 1);
         
         commandEncoder->dispatchThreads(gridSize, threadGroupSizeObj);
@@ -256,8 +657,12 @@ void Jpeg::copyImgCompToImage(MTL::ComputeCommandEncoder* commandEncoder) {
     
     auto bufferImage = NS::TransferPtr(_metalDevice->newBuffer(_image, _x * _y * sizeof(Colour), MTL::ResourceStorageModeShared, nullptr));
     
+    //luma is never subsampled, chroma kernels are instantiated per layout in duCopy.metal
     std::array<std::string, 3> funcs{"copyLumaToImage",
-        "copyChromaBlue", "copyChromaRed"};
+        "copyChromaBlue" + _chromaKernelSuffix, "copyChromaRed" + _chromaKernelSuffix};
+    if (_imageComponents.size() == 1) {
+        funcs[0] = "copyGreyscaleToImage";
+    }
     auto funcIt = funcs.begin();
     
     for (auto& ic : _imageComponents) {
@@ -265,14 +670,17 @@ void Jpeg::copyImgCompToImage(MTL::ComputeCommandEncoder* commandEncoder) {
         NS::Error* error = nullptr;
         auto functionPSO = NS::TransferPtr(_metalDevice->newComputePipelineState(function, &error));
         
-        auto icWidth = (_x / ic._hPixelsPerSample);
-        auto icHeight = (_y / ic._vPixelsPerSample);
-        
-        auto bufferImgComponent = NS::TransferPtr(_metalDevice->newBuffer(ic._icSubPixelData.get(), icWidth * icHeight * sizeof(int), MTL::ResourceStorageModeShared, nullptr));
+        auto bufferImgComponent = NS::TransferPtr(_metalDevice->newBuffer(ic._icSubPixelData.get(), planeBytes(ic), MTL::ResourceStorageModeShared, nullptr));
+        const uint32_t stride = static_cast<uint32_t>(ic._stride);
 
         commandEncoder->setComputePipelineState(functionPSO.get());
         commandEncoder->setBuffer(bufferImgComponent.get(), 0, 0);
         commandEncoder->setBuffer(bufferImage.get(), 0, 1);
+        commandEncoder->setBytes(&stride, sizeof(stride), 2);
+        
+        //only read by the generic chroma kernels
+        const uint32_t pixelsPerSample[2] = {ic._hPixelsPerSample, ic._vPixelsPerSample};
+        commandEncoder->setBytes(pixelsPerSample, sizeof(pixelsPerSample), 3);
 
         auto gridSize = MTL::Size(_x, _y, 1);
         auto threadGroupSizeObj = MTL::Size(16, 16, 1);
@@ -281,71 +689,226 @@ void Jpeg::copyImgCompToImage(MTL::ComputeCommandEncoder* commandEncoder) {
     }
 }
 
-void Jpeg::copyDUToSubpixels(DataUnit &du, image::Jpeg::ImageComponent &ic, size_t x, size_t y) {
-    int* subpixelData = ic._icSubPixelData.get();
-    size_t subpixelStart = (y / ic._vPixelsPerSample) * (_x / ic._hPixelsPerSample) + (x / ic._hPixelsPerSample);
+void Jpeg::copyLumaToPlane(MTL::ComputeCommandEncoder* commandEncoder) {
+    auto defaultLib = _metalDevice->newDefaultLibrary();
+    auto function = defaultLib->newFunction(NS::String::string("copyLumaToPlane", NS::ASCIIStringEncoding));
+    NS::Error* error = nullptr;
+    auto functionPSO = NS::TransferPtr(_metalDevice->newComputePipelineState(function, &error));
+    
+    auto& luma = _imageComponents[0];
+    auto bufferImage = NS::TransferPtr(_metalDevice->newBuffer(_lumaImage, lumaImageBytes(*this), MTL::ResourceStorageModeShared, nullptr));
+    auto bufferImgComponent = NS::TransferPtr(_metalDevice->newBuffer(luma._icSubPixelData.get(), planeBytes(luma), MTL::ResourceStorageModeShared, nullptr));
+    const uint32_t stride = static_cast<uint32_t>(luma._stride);
+    
+    commandEncoder->setComputePipelineState(functionPSO.get());
+    commandEncoder->setBuffer(bufferImgComponent.get(), 0, 0);
+    commandEncoder->setBuffer(bufferImage.get(), 0, 1);
+    commandEncoder->setBytes(&stride, sizeof(stride), 2);
     
-    for (size_t duRow = 0; duRow < 8; duRow++) {
-        size_t subpixelIncrement = duRow * (_x / ic._hPixelsPerSample);
-        std::memcpy(&subpixelData[subpixelStart + subpixelIncrement], &du[duRow * 8], 8 * sizeof(DataUnit::value_type));
+    auto gridSize = MTL::Size(_x, _y, 1);
+    auto threadGroupSizeObj = MTL::Size(16, 16, 1);
+    
+    commandEncoder->dispatchThreads(gridSize, threadGroupSizeObj);
+}
+
+void Jpeg::idctImgComp(size_t mcuRow, size_t xStart, size_t xEnd) {
+    for (auto& ic : _imageComponents) {
+        int* subpixelData = ic._icSubPixelData.get();
+        if (!subpixelData) {
+            continue;
+        }
+        size_t rowsPerMCU = _mcuHeight / ic._vPixelsPerSample;
+        size_t blockStart = xStart / ic._hPixelsPerSample / 8 * 8;
+        size_t blockEnd = xEnd == SIZE_MAX ? ic._width : std::min(roundUp((xEnd + ic._hPixelsPerSample - 1) / ic._hPixelsPerSample, 8), ic._width);
+        
+        for (size_t blockY = mcuRow * rowsPerMCU; blockY < (mcuRow + 1) * rowsPerMCU; blockY += 8) {
+            for (size_t blockX = blockStart; blockX < blockEnd; blockX += 8) {
+                DataUnit du;
+                for (size_t duRow = 0; duRow < 8; duRow++) {
+                    std::memcpy(&du[duRow * 8], &subpixelData[(blockY + duRow) * ic._stride + blockX], 8 * sizeof(DataUnit::value_type));
+                }
+                
+                idct(du);
+                
+                for (size_t duRow = 0; duRow < 8; duRow++) {
+                    std::memcpy(&subpixelData[(blockY + duRow) * ic._stride + blockX], &du[duRow * 8], 8 * sizeof(DataUnit::value_type));
+                }
+            }
+        }
+    }
+}
+
+void Jpeg::copyImgCompToImage(size_t yStart, size_t yEnd, Colour* out) {
+    const auto& luma = _imageComponents[0];
+    for (size_t y = yStart; y < yEnd; y++) {
+        const int* lumaRow = &luma._icSubPixelData[y * luma._stride];
+        Colour* imageRow = &out[(y - yStart) * _x];
+        for (size_t x = 0; x < _x; x++) {
+            imageRow[x].y = lumaRow[x];
+            imageRow[x].cb = 0;
+            imageRow[x].cr = 0;
+        }
+    }
+    
+    for (size_t channel = 1; channel < _imageComponents.size() && channel < 3; channel++) {
+        (this->*_chromaPlacer)(_imageComponents[channel], channel, yStart, yEnd, out);
+    }
+}
+
+void Jpeg::copyLumaToPlane(size_t mcuRow) {
+    size_t yStart = mcuRow * _mcuHeight;
+    size_t yEnd = std::min<size_t>(yStart + _mcuHeight, _y);
+    
+    const auto& luma = _imageComponents[0];
+    for (size_t y = yStart; y < yEnd; y++) {
+        const int* lumaRow = &luma._icSubPixelData[y * luma._stride];
+        uint8_t* planeRow = &_lumaImage[y * _lumaStride];
+        for (size_t x = 0; x < _x; x++) {
+            planeRow[x] = static_cast<uint8_t>(std::clamp(lumaRow[x] + 128, 0, 255));
+        }
     }
 }
 
+void Jpeg::copyChromaToImage(const ImageComponent& ic, size_t channel, size_t yStart, size_t yEnd, Colour* out) {
+    const int* subpixelData = ic._icSubPixelData.get();
+    
+    for (size_t y = yStart; y < yEnd; y++) {
+        for (size_t x = 0; x < _x; x++) {
+            out[(y - yStart) * _x + x].setIndexColour(channel, subpixelData[(y / ic._vPixelsPerSample) * ic._stride + (x / ic._hPixelsPerSample)]);
+        }
+    }
+}
+
+template<uint8_t H, uint8_t V>
+void Jpeg::copyChromaToImageSampled(const ImageComponent& ic, size_t channel, size_t yStart, size_t yEnd, Colour* out) {
+    const int* subpixelData = ic._icSubPixelData.get();
+    int Colour::* target = channel == 1 ? &Colour::cb : &Colour::cr;
+    
+    for (size_t y = yStart; y < yEnd; y++) {
+        const int* subpixelRow = &subpixelData[(y / V) * ic._stride];
+        Colour* imageRow = &out[(y - yStart) * _x];
+        for (size_t x = 0; x < _x; x++) {
+            imageRow[x].*target = subpixelRow[x / H];
+        }
+    }
+}
+
+int* Jpeg::blockInPlane(ImageComponent& ic, size_t x, size_t y) {
+    return &ic._icSubPixelData[(y / ic._vPixelsPerSample) * ic._stride + (x / ic._hPixelsPerSample)];
+}
+
 void Jpeg::readMCU(BitDecoder& dec, size_t x, size_t y) {
     for (auto icIdx = 0; icIdx < _imageComponentsInScan.size(); icIdx++) {
         auto &icS = _imageComponentsInScan[icIdx];
-                
-        size_t duCount = icS._ic->_h * icS._ic->_v;
+        auto &ic = *(icS._ic);
         
-        if (duCount == 1) {
-            auto du = readBlock(dec, icS);
-            copyDUToSubpixels(du, *(icS._ic), x, y);
-        } else {
-            const std::array<size_t, 4> xOffsetForDU = {0, 8, 0, 8};
-            const std::array<size_t, 4> yOffsetForDU = {0, 0, 8, 8};
-            
-            for (size_t i = 0; i < duCount; i++) {
-                auto du = readBlock(dec, icS);
-                copyDUToSubpixels(du, *(icS._ic), x + xOffsetForDU[i], y + yOffsetForDU[i]);
+        for (size_t duY = 0; duY < ic._v; duY++) {
+            for (size_t duX = 0; duX < ic._h; duX++) {
+                if (!ic._icSubPixelData) {
+                    skipBlock(dec, icS);
+                    continue;
+                }
+                
+                readBlock(dec, icS, blockInPlane(ic, x + duX * 8 * ic._hPixelsPerSample, y + duY * 8 * ic._vPixelsPerSample), ic._stride);
             }
         }
     }
 }
 
+template<uint8_t H, uint8_t V, bool LumaOnly>
+void Jpeg::readMCUSampled(BitDecoder& dec, size_t x, size_t y) {
+    auto &luma = _imageComponentsInScan[0];
+    [&]<size_t... I>(std::index_sequence<I...>) {
+        ((readBlock(dec, luma, blockInPlane(*luma._ic, x + (I % H) * 8, y + (I / H) * 8), luma._ic->_stride)), ...);
+    }(std::make_index_sequence<H * V>{});
+    
+    if constexpr (LumaOnly) {
+        skipBlock(dec, _imageComponentsInScan[1]);
+        skipBlock(dec, _imageComponentsInScan[2]);
+        return;
+    }
+    
+    auto &chromaBlue = _imageComponentsInScan[1];
+    readBlock(dec, chromaBlue, blockInPlane(*chromaBlue._ic, x, y), chromaBlue._ic->_stride);
+    
+    auto &chromaRed = _imageComponentsInScan[2];
+    readBlock(dec, chromaRed, blockInPlane(*chromaRed._ic, x, y), chromaRed._ic->_stride);
+}
+
+void Jpeg::readMCUGreyscale(BitDecoder& dec, size_t x, size_t y) {
+    //a single component scan is non-interleaved, A.2.2, so each MCU is one data unit
+    auto &luma = _imageComponentsInScan[0];
+    readBlock(dec, luma, blockInPlane(*luma._ic, x, y), luma._ic->_stride);
+}
+
+namespace {
+
+struct SamplingLayout {
+    const char* _name;
+    uint8_t _h; //luma sampling factors, chroma is always 1x1
+    uint8_t _v;
+    Jpeg::MCUDecoder _mcuDecoder;
+    Jpeg::MCUDecoder _lumaMCUDecoder;
+    Jpeg::ChromaPlacer _chromaPlacer;
+};
+
+const std::array<SamplingLayout, 5> samplingLayouts = {{
+    {"4:4:4", 1, 1, &Jpeg::readMCUSampled<1, 1>, &Jpeg::readMCUSampled<1, 1, true>, &Jpeg::copyChromaToImageSampled<1, 1>},
+    {"4:2:2", 2, 1, &Jpeg::readMCUSampled<2, 1>, &Jpeg::readMCUSampled<2, 1, true>, &Jpeg::copyChromaToImageSampled<2, 1>},
+    {"4:4:0", 1, 2, &Jpeg::readMCUSampled<1, 2>, &Jpeg::readMCUSampled<1, 2, true>, &Jpeg::copyChromaToImageSampled<1, 2>},
+    {"4:2:0", 2, 2, &Jpeg::readMCUSampled<2, 2>, &Jpeg::readMCUSampled<2, 2, true>, &Jpeg::copyChromaToImageSampled<2, 2>},
+    {"4:1:1", 4, 1, &Jpeg::readMCUSampled<4, 1>, &Jpeg::readMCUSampled<4, 1, true>, &Jpeg::copyChromaToImageSampled<4, 1>},
+}};
+
+}
+
 void Jpeg::appZeroData(std::span<uint8_t> data) {
-    std::cout << "\tDecoding APP0 data per JFIF" << std::endl;
+    if (_logSegments) {
+        std::cout << "\tDecoding APP0 data per JFIF" << std::endl;
+    }
     _identifier.insert(_identifier.end(), data.begin(), data.begin() + 5);
     _version = *reinterpret_cast<uint16_t*>(&data[5]);
     _units = *reinterpret_cast<uint8_t*>(&data[7]);
 }
 
 void Jpeg::quantisationTable(std::span<uint8_t> data) {
-    std::cout << "\tQuantisation Table data per B.2.4.1" << std::endl;
+    if (_logSegments) {
+        std::cout << "\tQuantisation Table data per B.2.4.1" << std::endl;
+    }
     
-    uint16_t index = 0;
+    size_t index = 0;
     while (index < data.size()) {
         uint8_t pq = data[index] >> 4; //quant precision flag
         uint8_t tq = data[index] & 0x0F; //quant table index
         index++;
-        std::cout << "\tQuantisation table " << static_cast<int>(tq) << ", ";
+        if (_logSegments) {
+            std::cout << "\tQuantisation table " << static_cast<int>(tq) << ", precision is " << (pq ? "16-bit" : "8-bit") << std::endl;
+        }
+        
+        if (tq >= _quantTables.size()) {
+            throw std::runtime_error("quantisation table destination out of range");
+        }
         
         if (pq == 1) {
-            std::cout << "precision is 16-bit" << std::endl;
             throw std::logic_error("not supported");
         } else if (pq == 0) {
-            std::cout << "precision is 8-bit" << std::endl;
+            if (index + 64 > data.size()) {
+                throw std::runtime_error("quantisation table truncated");
+            }
             std::copy(data.begin() + index, data.begin() + index + 64, _quantTables[tq].begin());
+            _dequantTables[tq] = dequantisationTable(_quantTables[tq], _idctVariant);
             index += 64;
         }
     }
 }
 
 void Jpeg::huffmanTable(std::span<uint8_t> data) {
-    std::cout << "\n\tDHT Define Huffman table " << data.size() << " bytes";
-    
     uint8_t tableClass = (*reinterpret_cast<uint8_t*>(&data[0]) & 0xF0) >> 4;
     uint8_t huffmanTableDestination = *reinterpret_cast<uint8_t*>(&data[0]) & 0x0F;
-    std::cout << ", Table class (Tc): " << static_cast<int>(tableClass) << ", Table Destination (Th): " << static_cast<int>(huffmanTableDestination) << std::endl;
+    if (_logSegments) {
+        std::cout << "\n\tDHT Define Huffman table " << data.size() << " bytes"
+                  << ", Table class (Tc): " << static_cast<int>(tableClass) << ", Table Destination (Th): " << static_cast<int>(huffmanTableDestination) << std::endl;
+    }
     
     std::span<uint8_t> tableDef(&data[1], data.size() - 1);
     HuffmanTable table = HuffmanTable::build(tableDef);
@@ -353,12 +916,17 @@ void Jpeg::huffmanTable(std::span<uint8_t> data) {
     if (tableClass == 0) {
         _huffmanTablesDC.at(huffmanTableDestination) = table;
     } else if (tableClass == 1) {
+        if (_multiSymbolAC) {
+            table.buildMultiSymbol();
+        }
         _huffmanTablesAC.at(huffmanTableDestination) = table;
     }
 }
 
 void Jpeg::sofBaselineDCT(std::span<uint8_t> data) {
-    std::cout << "\n\tSOF0 Baseline DCT Start of Frame" << std::endl;
+    if (_logSegments) {
+        std::cout << "\n\tSOF0 Baseline DCT Start of Frame" << std::endl;
+    }
     
     _frameSamplePrecision = *reinterpret_cast<uint8_t*>(&data[0]);
     _y = *reinterpret_cast<uint16_t*>(&data[1]);
@@ -367,7 +935,26 @@ void Jpeg::sofBaselineDCT(std::span<uint8_t> data) {
     _x = htons(_x);
     uint8_t nf = *reinterpret_cast<uint8_t*>(&data[5]);
     
-    _image = static_cast<Colour*>(malloc(_x * _y * sizeof(Colour)));
+    const bool lumaOnly = _outputMode == OutputMode::Luma;
+    const bool toDestination = (_destination._data || _tensor._data) && !_metalDevice;
+    if (_tensor._data) {
+        _tensorWriter = TensorWriter(_tensor, _x, _y);
+    }
+    if (_destination._data && _destination._stride < _x * bytesPerPixel(_destination._format)) {
+        throw std::runtime_error("destination stride too small for image width");
+    }
+    
+    if (!_allocatePlanes) {
+        //nothing to put the image in
+    } else if (lumaOnly && toDestination) {
+        _lumaImage = _destination._data;
+        _lumaStride = _destination._stride;
+    } else if (lumaOnly) {
+        _lumaImage = static_cast<uint8_t*>(_allocator->allocate(lumaImageBytes(*this), planeAlignment()));
+        _lumaStride = _x;
+    } else if (!toDestination) {
+        _image = static_cast<Colour*>(_allocator->allocate(imageBytes(*this), planeRowAlignment));
+    }
     
     for (unsigned int i = 0; i < nf; i++) {
         size_t byteStart = 6 + i * 3; //8 bits + 4 bits + 4 bits + 8 bits
@@ -377,7 +964,11 @@ void Jpeg::sofBaselineDCT(std::span<uint8_t> data) {
         ic._h = *reinterpret_cast<uint8_t*>(&data[byteStart + 1]) >> 4;
         ic._v = *reinterpret_cast<uint8_t*>(&data[byteStart + 1]) & 0x0F;
         ic._tq = *reinterpret_cast<uint8_t*>(&data[byteStart + 2]);
+        if (ic._tq >= _quantTables.size()) {
+            throw std::runtime_error("quantisation table selector out of range");
+        }
         ic._tqTable = &_quantTables[(int)ic._tq];
+        ic._dqTable = &_dequantTables[(int)ic._tq];
         _imageComponents.push_back(std::move(ic));
         
         hMax = std::max(hMax, ic._h);
@@ -395,7 +986,53 @@ void Jpeg::sofBaselineDCT(std::span<uint8_t> data) {
     for (auto& ic : _imageComponents) {
         ic._hPixelsPerSample = hMax / ic._h;
         ic._vPixelsPerSample = vMax / ic._v;
-        ic._icSubPixelData.reset(new int[(_x / ic._hPixelsPerSample) * (_y / ic._vPixelsPerSample)]);
+    }
+    
+    if (nf == 1) {
+        _mcuWidth = 8;
+        _mcuHeight = 8;
+    } else {
+        _mcuWidth = 8 * hMax;
+        _mcuHeight = 8 * vMax;
+    }
+    
+    const size_t mcusPerLine = (_x + _mcuWidth - 1) / _mcuWidth;
+    const size_t mcuLines = (_y + _mcuHeight - 1) / _mcuHeight;
+    for (auto& ic : _imageComponents) {
+        ic._width = mcusPerLine * _mcuWidth / ic._hPixelsPerSample;
+        ic._stride = roundUp(ic._width, planeRowAlignment / sizeof(int));
+        ic._rows = mcuLines * _mcuHeight / ic._vPixelsPerSample;
+        
+        //chroma is skipped over in luma mode, no plane needed
+        if (!_allocatePlanes || (lumaOnly && &ic != &_imageComponents[0])) {
+            continue;
+        }
+        
+        ic._icSubPixelData = {static_cast<int*>(_allocator->allocate(planeBytes(ic), planeAlignment())), PlaneDeleter{_allocator, planeBytes(ic)}};
+        //cleared once here, readBlock only writes the coefficients it decodes
+        std::memset(ic._icSubPixelData.get(), 0, planeBytes(ic));
+    }
+    
+    if (nf == 1) {
+        _mcuDecoder = &Jpeg::readMCUGreyscale;
+        return;
+    }
+    
+    auto layout = std::find_if(samplingLayouts.begin(), samplingLayouts.end(), [this](const SamplingLayout& l) {
+        return _imageComponents.size() == 3 &&
+               _imageComponents[0]._h == l._h && _imageComponents[0]._v == l._v &&
+               _imageComponents[1]._h == 1 && _imageComponents[1]._v == 1 &&
+               _imageComponents[2]._h == 1 && _imageComponents[2]._v == 1;
+    });
+    
+    if (layout != samplingLayouts.end()) {
+        _mcuDecoder = lumaOnly ? layout->_lumaMCUDecoder : layout->_mcuDecoder;
+        _chromaPlacer = layout->_chromaPlacer;
+        _chromaKernelSuffix = "_" + std::to_string(layout->_h) + "x" + std::to_string(layout->_v);
+    } else {
+        _mcuDecoder = &Jpeg::readMCU;
+        _chromaPlacer = &Jpeg::copyChromaToImage;
+        _chromaKernelSuffix = "";
     }
     
     if (nf != _imageComponents.size()) {
@@ -404,7 +1041,9 @@ void Jpeg::sofBaselineDCT(std::span<uint8_t> data) {
 }
 
 void Jpeg::startOfScan(std::span<uint8_t> data) {
-    std::cout << "\n\tSOS Start of Scan" << std::endl;
+    if (_logSegments) {
+        std::cout << "\n\tSOS Start of Scan" << std::endl;
+    }
     
     uint8_t ns = *reinterpret_cast<uint8_t*>(&data[0]);
     if (ns > _imageComponents.size()) {
@@ -428,6 +1067,9 @@ void Jpeg::startOfScan(std::span<uint8_t> data) {
         
         ic._tdTable = &_huffmanTablesDC.at(ic._td);
         ic._taTable = &_huffmanTablesAC.at(ic._ta);
+#ifdef DANPG_DECODE_STATS
+        ic._stats = &_stats._components.at(j);
+#endif
         _imageComponentsInScan.push_back(ic);
     }
     size_t afterComponents = 1 + 2 * ns;
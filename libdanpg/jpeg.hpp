@@ -8,10 +8,19 @@
 #ifndef jpeg_hpp
 #define jpeg_hpp
 
+#include <cstdint>
+#include <cstdlib>
 #include <istream>
+#include <memory>
+#include <string>
 
+#include "allocator.hpp"
 #include "colour.hpp"
+#include "decodedimage.hpp"
+#include "decodestats.hpp"
 #include "huffmantable.hpp"
+#include "idct.hpp"
+#include "ringbuffer.hpp"
 
 namespace MTL {
     class Device;
@@ -29,6 +38,11 @@ public:
     typedef std::array<uint8_t, 64> QuantisationTable;
     std::array<QuantisationTable, 4> _quantTables;
     
+    //natural order multipliers with the idct prescale folded in
+    typedef std::array<int, 64> DequantisationTable;
+    std::array<DequantisationTable, 4> _dequantTables;
+    IdctVariant _idctVariant = IdctVariant::Loeffler;
+    
     std::array<HuffmanTable, 4> _huffmanTablesAC;
     std::array<HuffmanTable, 4> _huffmanTablesDC;
     
@@ -37,6 +51,14 @@ public:
     uint16_t _x; //number of samples per line
     uint8_t hMax = 0; //max horizontal sampling factor
     uint8_t vMax = 0; //max vertical sampling factor
+    size_t _mcuWidth = 8; //pixels covered by one MCU
+    size_t _mcuHeight = 8;
+    
+    struct PlaneDeleter {
+        Allocator* _allocator;
+        size_t _bytes;
+        void operator()(int* plane) const { _allocator->deallocate(plane, _bytes); }
+    };
     
     struct ImageComponent {
         uint8_t _c; //component identifier
@@ -44,13 +66,18 @@ public:
         uint8_t _v; //vertical sampling factor
         uint8_t _tq; //quantization table destination selector
         QuantisationTable* _tqTable;
+        DequantisationTable* _dqTable;
         
         //how many image pixels for each sample
         //ie: Cb has 1 sample of every 2 pixels in both H and V
         uint8_t _hPixelsPerSample;
         uint8_t _vPixelsPerSample;
         
-        std::unique_ptr<int> _icSubPixelData;
+        //plane is padded out to whole MCUs, rows start 64 byte aligned
+        std::unique_ptr<int[], PlaneDeleter> _icSubPixelData;
+        size_t _width = 0; //samples per row covered by MCUs
+        size_t _stride = 0; //ints per plane row
+        size_t _rows = 0;
     };
     std::vector<ImageComponent> _imageComponents;
     
@@ -64,26 +91,108 @@ public:
         HuffmanTable* _taTable;
         
         int prevDC = 0;
+#ifdef DANPG_DECODE_STATS
+        DecodeStats::Component* _stats = nullptr;
+#endif
     };
     std::vector<ImageComponentInScan> _imageComponentsInScan;
     
     typedef std::array<int, 8*8> DataUnit;
     
+    //MCU decode and chroma placement are specialised per sampling layout.
+    //the layout is picked once in sofBaselineDCT, with readMCU and
+    //copyChromaToImage as the generic fallbacks for anything unusual.
+    typedef void (Jpeg::*MCUDecoder)(BitDecoder& dec, size_t x, size_t y);
+    typedef void (Jpeg::*ChromaPlacer)(const ImageComponent& ic, size_t channel, size_t yStart, size_t yEnd, Colour* out);
+    MCUDecoder _mcuDecoder = &Jpeg::readMCU;
+    ChromaPlacer _chromaPlacer = &Jpeg::copyChromaToImage;
+    std::string _chromaKernelSuffix;
+    
     size_t _numberOfMCU = 0;
     bool _inScan = false;
+    //a corrupt or truncated scan stops at the first bad MCU, everything
+    //before it is kept. the image is complete when _mcusDecoded covers it.
+    DecodeError _scanError = DecodeError::None;
+    size_t _mcusDecoded = 0;
+#ifdef DANPG_DECODE_STATS
+    //handed on with the image by takeImage
+    DecodeStats _stats;
+#endif
+    //remove byte stuffing in a pre-pass so the bit reader refills without
+    //checking every byte for markers. costs a copy of the scan.
+    bool _unstuffScan = false;
+    //ac tables also get a multi-symbol table, see HuffmanTable::buildMultiSymbol.
+    //worth it when short codes dominate, as in heavily compressed images.
+    bool _multiSymbolAC = false;
+    //print each marker segment to std::cout as it is parsed, for debugging.
+    //off by default, a library shouldn't write to stdout
+    bool _logSegments = false;
+    //off leaves the planes and output image to the caller, sofBaselineDCT
+    //still works out their sizes. for decoding a band of rows at a time.
+    bool _allocatePlanes = true;
     
     MTL::Device* _metalDevice = nullptr;
+    //planes, _image and _lumaImage all come from here
+    Allocator* _allocator = &defaultAllocator();
     Colour* _image = nullptr;
     
+    //luma mode skips over the chroma entropy data without storing it and
+    //emits an 8 bit Y plane in _lumaImage instead of filling _image
+    enum class OutputMode {
+        Colour,
+        Luma,
+    };
+    OutputMode _outputMode = OutputMode::Colour;
+    uint8_t* _lumaImage = nullptr;
+    size_t _lumaStride = 0; //bytes between _lumaImage rows
+    
+    //optional caller owned output. the cpu transform packs finished pixels
+    //straight into it a line at a time, so _image is never allocated. Grey8
+    //implies luma mode. metal still converts in _image then packs it here.
+    struct Destination {
+        uint8_t* _data = nullptr;
+        size_t _stride = 0; //bytes between rows
+        PixelFormat _format = PixelFormat::RGBA8;
+    };
+    Destination _destination;
+    
+    //optional tensor output, filled the same way as a destination
+    TensorOutput _tensor;
+    TensorWriter _tensorWriter;
+    
+    //without a metal device, transform MCU rows on this many worker threads
+    //while the scan is decoded. zero runs the transform after the scan.
+    size_t _pipelineThreads = 0;
+    typedef RingBuffer<size_t, 64> MCURowQueue;
+    static constexpr size_t endOfScan = SIZE_MAX;
+    
 public:
-    Jpeg(std::span<uint8_t> is, MTL::Device* metalDevice);
+    Jpeg(std::span<uint8_t> is, MTL::Device* metalDevice, size_t pipelineThreads = 0, OutputMode outputMode = OutputMode::Colour);
+    //destination must hold _y rows of destination._stride bytes
+    Jpeg(std::span<uint8_t> is, Destination destination, MTL::Device* metalDevice = nullptr, size_t pipelineThreads = 0);
+    //tensor must hold _batchIndex + 1 images of 3 x _y x _x elements
+    Jpeg(std::span<uint8_t> is, TensorOutput tensor, MTL::Device* metalDevice = nullptr, size_t pipelineThreads = 0);
     Jpeg();
+    //releases _image and _lumaImage unless they were taken
+    ~Jpeg();
+    
+    //over a megabyte of tables and a raw image, pass the result on instead
+    Jpeg(const Jpeg&) = delete;
+    Jpeg& operator=(const Jpeg&) = delete;
     
+    void decode(std::span<uint8_t> is);
     size_t readData(std::span<uint8_t> is);
     size_t readScanData(std::span<uint8_t> is);
     void readMCU(BitDecoder& dec, size_t x, size_t y);
-    DataUnit readBlock(BitDecoder& dec, ImageComponentInScan& ic);
+    template<uint8_t H, uint8_t V, bool LumaOnly = false> void readMCUSampled(BitDecoder& dec, size_t x, size_t y);
+    void readMCUGreyscale(BitDecoder& dec, size_t x, size_t y);
+    //decodes straight into a zeroed block at out, returning the zigzag index
+    //of the last coefficient written
+    size_t readBlock(BitDecoder& dec, ImageComponentInScan& ic, int* out, size_t stride);
+    //consumes a block's bits without extending, dequantising or storing anything
+    void skipBlock(BitDecoder& dec, ImageComponentInScan& ic);
     uint8_t deZigZag(uint8_t index);
+    static DequantisationTable dequantisationTable(const QuantisationTable& table, IdctVariant variant);
     
     void appZeroData(std::span<uint8_t> data);
     void quantisationTable(std::span<uint8_t> data);
@@ -93,11 +202,46 @@ public:
     void startOfScan(std::span<uint8_t> data);
     void restartInterval(std::span<uint8_t> data);
     
-    void copyDUToSubpixels(DataUnit& du, image::Jpeg::ImageComponent& ic, size_t x, size_t y);
+    int* blockInPlane(ImageComponent& ic, size_t x, size_t y);
     void copyImgCompToImage(MTL::ComputeCommandEncoder* commandQueue);
     void idctImgComp(MTL::ComputeCommandEncoder* commandQueue);
+    void copyLumaToPlane(MTL::ComputeCommandEncoder* commandQueue);
+    
+    //cpu fallbacks for when no metal device is provided, one MCU row at a time
+    void transformWorker(MCURowQueue& rowQueue);
+    void transformMCURow(size_t mcuRow);
+    //out holds the image lines yStart to yEnd
+    void copyImgCompToImage(size_t yStart, size_t yEnd, Colour* out);
+    //only the blocks under image columns xStart to xEnd, for tiles that need
+    //part of a row
+    void idctImgComp(size_t mcuRow, size_t xStart = 0, size_t xEnd = SIZE_MAX);
+    void copyLumaToPlane(size_t mcuRow);
+    void copyChromaToImage(const ImageComponent& ic, size_t channel, size_t yStart, size_t yEnd, Colour* out);
+    template<uint8_t H, uint8_t V> void copyChromaToImageSampled(const ImageComponent& ic, size_t channel, size_t yStart, size_t yEnd, Colour* out);
+    void packImageToOutputs();
+    //hands _image and _lumaImage back to the allocator
+    void releaseImage();
+    //moves _image, or _lumaImage in luma mode, out into an owning handle
+    DecodedImage takeImage();
+};
+
+struct DecodeOptions {
+    MTL::Device* _metalDevice = nullptr;
+    size_t _pipelineThreads = 0;
+    Jpeg::OutputMode _outputMode = Jpeg::OutputMode::Colour;
+    bool _unstuffScan = false;
+    bool _multiSymbolAC = false;
+    bool _logSegments = false;
+    Allocator* _allocator = &defaultAllocator();
 };
 
+//decodes with a Jpeg that only lives for the call, returning just the pixels
+DecodedImage decodeImage(std::span<uint8_t> data, const DecodeOptions& options = {});
+
+//decodes the Exif thumbnail instead when it is at least minWidth x minHeight,
+//otherwise the whole image
+DecodedImage decodeThumbnail(std::span<uint8_t> data, size_t minWidth, size_t minHeight, const DecodeOptions& options = {});
+
 }
 
 #endif /* jpeg_hpp */
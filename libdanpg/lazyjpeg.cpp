@@ -0,0 +1,254 @@
+//
+//  lazyjpeg.cpp
+//  libdanpg
+//
+//  Created by Daniel Burke on 19/10/2026.
+//
+
+#include "lazyjpeg.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+using namespace image;
+
+namespace {
+
+const size_t bufferAlignment = 64;
+
+size_t roundUp(size_t value, size_t multiple) {
+    return (value + multiple - 1) / multiple * multiple;
+}
+
+size_t bandBytes(const Jpeg::ImageComponent& ic) {
+    return roundUp(ic._stride * ic._rows * sizeof(int), bufferAlignment);
+}
+
+}
+
+LazyJpeg::LazyJpeg(std::span<uint8_t> data, size_t tileSize, size_t cachedTiles, Allocator& allocator) : _allocator(allocator), _dataBytes(data.size()), _tileSize(tileSize), _cachedTiles(cachedTiles) {
+    if (_tileSize == 0 || _cachedTiles == 0) {
+        throw std::logic_error("tile size and cache size must not be zero");
+    }
+
+    _jpeg._allocator = &_allocator;
+    _jpeg._allocatePlanes = false;
+
+    size_t position = 0;
+    while (position < data.size() && !_jpeg._inScan) {
+        position += _jpeg.readData(data.subspan(position));
+    }
+
+    if (!_jpeg._inScan || _jpeg._imageComponents.empty()) {
+        throw std::runtime_error("no baseline frame and scan to decode");
+    }
+
+    if (_jpeg._imageComponentsInScan.size() != _jpeg._imageComponents.size() || _jpeg._imageComponentsInScan.size() > 4) {
+        throw std::runtime_error("lazy decode needs every component in one scan");
+    }
+
+    _scan = data.subspan(position);
+    _scanOffset = position;
+    _headerHash = ScanIndex::hashHeaders(data, position);
+
+    //the planes only hold one MCU row, which is always decoded at y = 0
+    for (auto& ic : _jpeg._imageComponents) {
+        ic._rows = _jpeg._mcuHeight / ic._vPixelsPerSample;
+        ic._icSubPixelData = {static_cast<int*>(_allocator.allocate(bandBytes(ic), bufferAlignment)), Jpeg::PlaneDeleter{&_allocator, bandBytes(ic)}};
+    }
+
+    _checkpoints.resize((height() + _jpeg._mcuHeight - 1) / _jpeg._mcuHeight);
+    _checkpoints[0] = Checkpoint{{0, 0}, {}};
+}
+
+std::shared_ptr<const DecodedImage> LazyJpeg::tile(size_t column, size_t row) {
+    if (column >= tileColumns() || row >= tileRows()) {
+        throw std::out_of_range("tile is outside the image");
+    }
+
+    size_t key = row * tileColumns() + column;
+    auto cached = _tiles.find(key);
+    if (cached != _tiles.end()) {
+        _tileCacheHits++;
+        _recentTiles.splice(_recentTiles.begin(), _recentTiles, cached->second._recent);
+        return cached->second._tile;
+    }
+
+    size_t x = column * _tileSize;
+    size_t y = row * _tileSize;
+    auto decoded = std::make_shared<const DecodedImage>(decodeTile(x, y, std::min(_tileSize, width() - x), std::min(_tileSize, height() - y)));
+    //a tile behind a corrupt row may come out whole once an index is used,
+    //so only complete ones are kept
+    if (decoded->_error != DecodeError::None) {
+        return decoded;
+    }
+
+    if (_tiles.size() == _cachedTiles) {
+        _tiles.erase(_recentTiles.back());
+        _recentTiles.pop_back();
+    }
+
+    _recentTiles.push_front(key);
+    _tiles[key] = {decoded, _recentTiles.begin()};
+    return decoded;
+}
+
+ScanIndex LazyJpeg::index(size_t rowsPerEntry) {
+    if (rowsPerEntry == 0) {
+        throw std::logic_error("index needs at least a row between entries");
+    }
+    
+    //fills in every checkpoint it can, going through the rows in order
+    for (size_t row = 0; row + 1 < _checkpoints.size(); row++) {
+        if (!_checkpoints[row + 1]) {
+            decodeMCURow(row);
+        }
+    }
+    
+    ScanIndex index;
+    index._dataBytes = _dataBytes;
+    index._scanOffset = _scanOffset;
+    index._headerHash = _headerHash;
+    index._components = _jpeg._imageComponentsInScan.size();
+    index._rowsPerEntry = rowsPerEntry;
+    for (size_t row = 0; row < _checkpoints.size(); row += rowsPerEntry) {
+        if (_checkpoints[row]) {
+            index._entries.push_back({row, _checkpoints[row]->_position, _checkpoints[row]->_prevDC});
+        }
+    }
+    
+    return index;
+}
+
+void LazyJpeg::useIndex(const ScanIndex& index) {
+    if (index._dataBytes != _dataBytes || index._scanOffset != _scanOffset || index._headerHash != _headerHash ||
+        index._components != _jpeg._imageComponentsInScan.size()) {
+        throw std::runtime_error("scan index was built from a different image");
+    }
+    
+    for (auto& entry : index._entries) {
+        if (entry._mcuRow >= _checkpoints.size() || entry._position._byte > _scan.size()) {
+            throw std::runtime_error("scan index entry is outside the scan");
+        }
+        
+        if (!_checkpoints[entry._mcuRow]) {
+            _checkpoints[entry._mcuRow] = Checkpoint{entry._position, entry._prevDC};
+        }
+    }
+}
+
+DecodedImage LazyJpeg::decodeTile(size_t x, size_t y, size_t width, size_t height) {
+    size_t stride = width * sizeof(Colour);
+    size_t bytes = roundUp(stride * height, bufferAlignment);
+    DecodedImage tile(_allocator.allocate(bytes, bufferAlignment), bytes, _allocator, width, height, stride, DecodedImage::Format::Colour);
+
+    for (size_t mcuRow = y / _jpeg._mcuHeight; mcuRow * _jpeg._mcuHeight < y + height; mcuRow++) {
+        auto error = decodeMCURow(mcuRow);
+        if (tile._error == DecodeError::None) {
+            tile._error = error;
+        }
+
+        transformBand(mcuRow, x, y, tile);
+    }
+
+    _tilesDecoded++;
+    return tile;
+}
+
+DecodeError LazyJpeg::decodeMCURow(size_t mcuRow) {
+    const size_t mcusPerLine = (_jpeg._x + _jpeg._mcuWidth - 1) / _jpeg._mcuWidth;
+    const size_t mcuLines = _checkpoints.size();
+    auto& componentsInScan = _jpeg._imageComponentsInScan;
+
+    //rows below a corrupt one can only be reached from a checkpoint after
+    //it, which only an index can give. otherwise the corrupt row is decoded
+    //again and fails again, leaving the band zeroed.
+    size_t row = mcuRow;
+    while (!_checkpoints[row]) {
+        row--;
+    }
+    
+    for (; row <= mcuRow; row++) {
+        clearBand();
+
+        const auto& checkpoint = *_checkpoints[row];
+        BitDecoder dec;
+        dec.setData(_scan);
+        dec.seek(checkpoint._position);
+        for (size_t i = 0; i < componentsInScan.size(); i++) {
+            componentsInScan[i].prevDC = checkpoint._prevDC[i];
+        }
+
+        size_t mcu = row * mcusPerLine;
+        for (size_t x = 0; x < _jpeg._x; x += _jpeg._mcuWidth) {
+            (_jpeg.*_jpeg._mcuDecoder)(dec, x, 0);
+            if (dec.error() != DecodeError::None) {
+                break;
+            }
+
+            mcu++;
+            if (_jpeg._numberOfMCU && mcu % _jpeg._numberOfMCU == 0) {
+                dec.reset();
+                for (auto& icS : componentsInScan) {
+                    icS.prevDC = 0;
+                }
+            }
+        }
+        _mcuRowsDecoded++;
+
+        if (dec.error() != DecodeError::None) {
+            if (row != mcuRow) {
+                clearBand();
+            }
+            return dec.error();
+        }
+
+        if (row + 1 < mcuLines && !_checkpoints[row + 1]) {
+            Checkpoint next{dec.bitPosition(), {}};
+            for (size_t i = 0; i < componentsInScan.size(); i++) {
+                next._prevDC[i] = componentsInScan[i].prevDC;
+            }
+            _checkpoints[row + 1] = next;
+        }
+    }
+
+    return DecodeError::None;
+}
+
+void LazyJpeg::clearBand() {
+    //readBlock only writes the coefficients it decodes
+    for (auto& ic : _jpeg._imageComponents) {
+        std::memset(ic._icSubPixelData.get(), 0, ic._stride * ic._rows * sizeof(int));
+    }
+}
+
+void LazyJpeg::transformBand(size_t mcuRow, size_t x, size_t y, DecodedImage& tile) {
+    //the whole row was entropy decoded, only the blocks under the tile are
+    //transformed. the band holds just this row, so it is row 0 of the planes.
+    _jpeg.idctImgComp(0, x, x + tile._width);
+
+    const size_t bandTop = mcuRow * _jpeg._mcuHeight;
+    const size_t yStart = std::max(bandTop, y);
+    const size_t yEnd = std::min(bandTop + _jpeg._mcuHeight, y + tile._height);
+    const auto& luma = _jpeg._imageComponents[0];
+    for (size_t imageY = yStart; imageY < yEnd; imageY++) {
+        Colour* tileRow = &tile.colours()[(imageY - y) * tile._width];
+        const int* lumaRow = &luma._icSubPixelData[(imageY - bandTop) * luma._stride];
+        for (size_t i = 0; i < tile._width; i++) {
+            tileRow[i].y = lumaRow[x + i];
+            tileRow[i].cb = 0;
+            tileRow[i].cr = 0;
+        }
+
+        for (size_t channel = 1; channel < _jpeg._imageComponents.size() && channel < 3; channel++) {
+            const auto& ic = _jpeg._imageComponents[channel];
+            const int* chromaRow = &ic._icSubPixelData[((imageY - bandTop) / ic._vPixelsPerSample) * ic._stride];
+            for (size_t i = 0; i < tile._width; i++) {
+                tileRow[i].setIndexColour(channel, chromaRow[(x + i) / ic._hPixelsPerSample]);
+            }
+        }
+
+        ycbcrToRGBOverImage(tileRow, tile._width, 1);
+    }
+}
@@ -0,0 +1,102 @@
+//
+//  lazyjpeg.hpp
+//  libdanpg
+//
+//  Created by Daniel Burke on 19/10/2026.
+//
+
+#ifndef lazyjpeg_hpp
+#define lazyjpeg_hpp
+
+#include <array>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <optional>
+#include <span>
+#include <unordered_map>
+#include <vector>
+
+#include "decodedimage.hpp"
+#include "jpeg.hpp"
+#include "scanindex.hpp"
+
+namespace image {
+
+//random access to tiles of a large baseline jpeg. headers are parsed when it
+//is opened and nothing else until a tile is asked for. the entropy decoder
+//state is kept at the start of every MCU row it has been through, so a tile
+//only costs the rows it covers plus any before them not reached yet. finished
+//tiles are kept in an LRU cache. not thread safe, guard it or use one per
+//thread, which can share a ScanIndex to split the work between them.
+class LazyJpeg {
+public:
+    //data must outlive the LazyJpeg, and allocator the tiles handed out.
+    //throws if it isn't a single scan baseline image.
+    LazyJpeg(std::span<uint8_t> data, size_t tileSize = 256, size_t cachedTiles = 64, Allocator& allocator = defaultAllocator());
+
+    LazyJpeg(const LazyJpeg&) = delete;
+    LazyJpeg& operator=(const LazyJpeg&) = delete;
+
+    size_t width() const { return _jpeg._x; }
+    size_t height() const { return _jpeg._y; }
+    size_t tileColumns() const { return (width() + _tileSize - 1) / _tileSize; }
+    size_t tileRows() const { return (height() + _tileSize - 1) / _tileSize; }
+
+    //colour pixels of the tileSize square at column, row, cropped at the
+    //right and bottom edges. stays valid after the cache lets go of it.
+    //tiles with an error aren't cached, asking again decodes them again.
+    std::shared_ptr<const DecodedImage> tile(size_t column, size_t row);
+
+    //entropy decodes whatever of the scan hasn't been reached yet and returns
+    //the state at every rowsPerEntry MCU rows. a corrupt scan is indexed up to
+    //the row that fails.
+    ScanIndex index(size_t rowsPerEntry = 8);
+    //starts decodes from the index's entries as well. throws if it was built
+    //from a different image.
+    void useIndex(const ScanIndex& index);
+
+    size_t _tilesDecoded = 0;
+    size_t _tileCacheHits = 0;
+    size_t _mcuRowsDecoded = 0;
+
+private:
+    //everything needed to pick the scan up at the start of an MCU row
+    struct Checkpoint {
+        BitDecoder::BitPosition _position;
+        std::array<int, 4> _prevDC;
+    };
+
+    struct CachedTile {
+        std::shared_ptr<const DecodedImage> _tile;
+        std::list<size_t>::iterator _recent;
+    };
+
+    DecodedImage decodeTile(size_t x, size_t y, size_t width, size_t height);
+    //leaves the MCU row in the band planes, decoding from the nearest
+    //checkpoint above it
+    DecodeError decodeMCURow(size_t mcuRow);
+    void clearBand();
+    void transformBand(size_t mcuRow, size_t x, size_t y, DecodedImage& tile);
+
+    Jpeg _jpeg;
+    Allocator& _allocator;
+    std::span<const uint8_t> _scan;
+    size_t _dataBytes;
+    size_t _scanOffset = 0;
+    uint64_t _headerHash = 0;
+    size_t _tileSize;
+    size_t _cachedTiles;
+
+    //the state at the start of each MCU row, where it is known. row 0 always
+    //is, and decoding a row fills in the next.
+    std::vector<std::optional<Checkpoint>> _checkpoints;
+
+    //most recently used first
+    std::list<size_t> _recentTiles;
+    std::unordered_map<size_t, CachedTile> _tiles;
+};
+
+}
+
+#endif /* lazyjpeg_hpp */
@@ -0,0 +1,300 @@
+//
+//  mjpeg.cpp
+//  libdanpg
+//
+//  Created by Daniel Burke on 19/10/2026.
+//
+
+#include "mjpeg.hpp"
+
+#include "probe.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <numeric>
+#include <stdexcept>
+
+using namespace image;
+
+const std::vector<uint8_t> image::defaultDCLuminance = {
+    0x00,
+    0x00, 0x01, 0x05, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b,
+};
+
+const std::vector<uint8_t> image::defaultDCChrominance = {
+    0x01,
+    0x00, 0x03, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b,
+};
+
+const std::vector<uint8_t> image::defaultACLuminance = {
+    0x10,
+    0x00, 0x02, 0x01, 0x03, 0x03, 0x02, 0x04, 0x03, 0x05, 0x05, 0x04, 0x04, 0x00, 0x00, 0x01, 0x7d,
+    0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07,
+    0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xa1, 0x08, 0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0,
+    0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0a, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28,
+    0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49,
+    0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
+    0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+    0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7,
+    0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5,
+    0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2,
+    0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+    0xf9, 0xfa,
+};
+
+const std::vector<uint8_t> image::defaultACChrominance = {
+    0x11,
+    0x00, 0x02, 0x01, 0x02, 0x04, 0x04, 0x03, 0x04, 0x07, 0x05, 0x04, 0x04, 0x00, 0x01, 0x02, 0x77,
+    0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71,
+    0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91, 0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33, 0x52, 0xf0,
+    0x15, 0x62, 0x72, 0xd1, 0x0a, 0x16, 0x24, 0x34, 0xe1, 0x25, 0xf1, 0x17, 0x18, 0x19, 0x1a, 0x26,
+    0x27, 0x28, 0x29, 0x2a, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48,
+    0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68,
+    0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+    0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5,
+    0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3,
+    0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda,
+    0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+    0xf9, 0xfa,
+};
+
+namespace {
+
+struct DefaultHuffmanTable {
+    const std::vector<uint8_t>* _definition;
+    HuffmanTable _table;
+};
+
+//built once and copied into a decoder's slots whenever a frame needs them
+const std::array<DefaultHuffmanTable, 4>& defaultHuffmanTables() {
+    static const std::array<DefaultHuffmanTable, 4> tables = [] {
+        std::array<DefaultHuffmanTable, 4> built;
+        const std::array<const std::vector<uint8_t>*, 4> definitions = {
+            &defaultDCLuminance, &defaultDCChrominance, &defaultACLuminance, &defaultACChrominance
+        };
+
+        for (size_t i = 0; i < definitions.size(); i++) {
+            std::vector<uint8_t> tableDef(definitions[i]->begin() + 1, definitions[i]->end());
+            built[i] = {definitions[i], HuffmanTable::build(tableDef)};
+        }
+        return built;
+    }();
+    return tables;
+}
+
+}
+
+MjpegDecoder::MjpegDecoder(MTL::Device* metalDevice, size_t pipelineThreads, Jpeg::OutputMode outputMode, Allocator& allocator) {
+    _jpeg._metalDevice = metalDevice;
+    _jpeg._allocator = &allocator;
+    _jpeg._pipelineThreads = pipelineThreads;
+    _jpeg._outputMode = outputMode;
+}
+
+MjpegDecoder::~MjpegDecoder() {
+    releaseFrame();
+}
+
+size_t MjpegDecoder::decodeFrame(std::span<uint8_t> data) {
+    if (data.size() < 2 || data[0] != 0xff || data[1] != 0xd8) {
+        throw std::runtime_error("frame does not start with SOI");
+    }
+
+    _jpeg._imageComponentsInScan.clear();
+    _jpeg._numberOfMCU = 0;
+    _jpeg._mcusDecoded = 0;
+    _jpeg._scanError = DecodeError::None;
+#ifdef DANPG_DECODE_STATS
+    //per frame, clearing keeps the row vector's capacity for the next one
+    _jpeg._stats._components = {};
+    _jpeg._stats._bitsPerMCURow.clear();
+#endif
+    bool huffmanTablesDefined = false;
+
+    size_t position = 2;
+    while (position + 1 < data.size()) {
+        if (data[position] != 0xff) {
+            position++;
+            continue;
+        }
+
+        uint8_t marker = data[position + 1];
+        if (marker == 0xff) {
+            position++;
+            continue;
+        }
+
+        if (marker == 0xd9) {
+            _framesDecoded++;
+            return position + 2;
+        }
+
+        //a scan that stopped early leaves its stuffed bytes and restart
+        //markers behind, neither has a length to skip by
+        if (marker == 0x00 || marker == 0x01 || (marker >= 0xd0 && marker <= 0xd7)) {
+            position += 2;
+            continue;
+        }
+
+        if (position + 4 > data.size()) {
+            break;
+        }
+
+        size_t length = readBigEndian16(&data[position + 2]);
+        if (length < 2 || position + 2 + length > data.size()) {
+            throw std::runtime_error("marker segment truncated");
+        }
+
+        auto segment = data.subspan(position + 4, length - 2);
+        position += 2 + length;
+
+        switch (marker) {
+            case 0xdb:
+                _jpeg.quantisationTable(segment);
+                break;
+
+            case 0xc4:
+                huffmanTables(segment);
+                huffmanTablesDefined = true;
+                break;
+
+            case 0xc0:
+                startOfFrame(segment);
+                break;
+
+            case 0xdd:
+                _jpeg.restartInterval(segment);
+                break;
+
+            case 0xda:
+                if (_jpeg._imageComponents.empty()) {
+                    throw std::runtime_error("scan before frame header");
+                }
+
+                //most camera frames rely on the tables in the standard
+                if (!huffmanTablesDefined) {
+                    installDefaultHuffmanTables();
+                    huffmanTablesDefined = true;
+                }
+
+                _jpeg._imageComponentsInScan.clear();
+                _jpeg.startOfScan(segment);
+                position += _jpeg.readScanData(data.subspan(position));
+                break;
+
+            default:
+                if (isFrameMarker(marker)) {
+                    throw std::logic_error("only baseline frames are supported");
+                }
+                break;
+        }
+    }
+
+    //truncated frame, whatever was decoded is kept
+    _framesDecoded++;
+    return data.size();
+}
+
+size_t MjpegDecoder::decodeStream(std::span<uint8_t> stream, const FrameCallback& onFrame) {
+    size_t frames = 0;
+    size_t position = 0;
+
+    while (position + 1 < stream.size()) {
+        auto found = static_cast<uint8_t*>(std::memchr(&stream[position], 0xff, stream.size() - position - 1));
+        if (!found) {
+            break;
+        }
+
+        position = found - stream.data();
+        if (stream[position + 1] != 0xd8) {
+            position++;
+            continue;
+        }
+
+        position += decodeFrame(stream.subspan(position));
+        if (onFrame) {
+            onFrame(_jpeg, frames);
+        }
+        frames++;
+    }
+
+    return frames;
+}
+
+void MjpegDecoder::huffmanTables(std::span<uint8_t> data) {
+    //a segment can hold several table definitions, B.2.4.2
+    size_t position = 0;
+    while (position < data.size()) {
+        if (position + 17 > data.size()) {
+            throw std::runtime_error("huffman table definition truncated");
+        }
+
+        uint8_t tableClass = data[position] >> 4;
+        uint8_t destination = data[position] & 0x0f;
+        auto bits = data.subspan(position + 1, 16);
+        size_t definitionBytes = 17 + std::accumulate(bits.begin(), bits.end(), size_t{0});
+        if (tableClass > 1 || destination > 3 || position + definitionBytes > data.size()) {
+            throw std::runtime_error("huffman table definition is malformed");
+        }
+
+        auto definition = data.subspan(position, definitionBytes);
+        auto& source = _huffmanSources[tableClass * 4 + destination];
+        if (!std::equal(definition.begin(), definition.end(), source.begin(), source.end())) {
+            auto& tables = tableClass == 0 ? _jpeg._huffmanTablesDC : _jpeg._huffmanTablesAC;
+            tables[destination] = HuffmanTable::build(definition.subspan(1));
+            if (tableClass == 1 && _jpeg._multiSymbolAC) {
+                tables[destination].buildMultiSymbol();
+            }
+            source.assign(definition.begin(), definition.end());
+            _huffmanTablesBuilt++;
+        }
+
+        position += definitionBytes;
+    }
+}
+
+void MjpegDecoder::installDefaultHuffmanTables() {
+    for (auto& defaultTable : defaultHuffmanTables()) {
+        auto& definition = *defaultTable._definition;
+        uint8_t tableClass = definition[0] >> 4;
+        uint8_t destination = definition[0] & 0x0f;
+
+        auto& source = _huffmanSources[tableClass * 4 + destination];
+        if (source != definition) {
+            auto& tables = tableClass == 0 ? _jpeg._huffmanTablesDC : _jpeg._huffmanTablesAC;
+            tables[destination] = defaultTable._table;
+            if (tableClass == 1 && _jpeg._multiSymbolAC) {
+                tables[destination].buildMultiSymbol();
+            }
+            source = definition;
+        }
+    }
+}
+
+void MjpegDecoder::startOfFrame(std::span<uint8_t> data) {
+    bool unchanged = std::equal(data.begin(), data.end(), _frameHeader.begin(), _frameHeader.end());
+    if (unchanged && !_jpeg._imageComponents.empty()) {
+        //readBlock expects zeroed planes, the last frame left samples in them
+        for (auto& ic : _jpeg._imageComponents) {
+            if (ic._icSubPixelData) {
+                std::memset(ic._icSubPixelData.get(), 0, ic._stride * ic._rows * sizeof(int));
+            }
+        }
+        _frameHeadersReused++;
+        return;
+    }
+
+    releaseFrame();
+    _jpeg.sofBaselineDCT(data);
+    _frameHeader.assign(data.begin(), data.end());
+}
+
+void MjpegDecoder::releaseFrame() {
+    _jpeg.releaseImage();
+    _jpeg._imageComponents.clear();
+    _jpeg.hMax = 0;
+    _jpeg.vMax = 0;
+    _frameHeader.clear();
+}
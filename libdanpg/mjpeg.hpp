@@ -0,0 +1,73 @@
+//
+//  mjpeg.hpp
+//  libdanpg
+//
+//  Created by Daniel Burke on 19/10/2026.
+//
+
+#ifndef mjpeg_hpp
+#define mjpeg_hpp
+
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <span>
+#include <vector>
+
+#include "jpeg.hpp"
+
+namespace image {
+
+//Annex K.3 tables, laid out as a DHT table definition: Tc Th, the 16 code
+//counts and then the values, B.2.4.2
+extern const std::vector<uint8_t> defaultDCLuminance;
+extern const std::vector<uint8_t> defaultDCChrominance;
+extern const std::vector<uint8_t> defaultACLuminance;
+extern const std::vector<uint8_t> defaultACChrominance;
+
+//decodes a run of motion jpeg frames through one Jpeg. frames that leave out
+//DHT get the Annex K tables, huffman tables are only rebuilt when their
+//definition changes and a frame header matching the previous frame keeps its
+//planes and output image rather than setting them up again.
+class MjpegDecoder {
+public:
+    MjpegDecoder(MTL::Device* metalDevice = nullptr, size_t pipelineThreads = 0, Jpeg::OutputMode outputMode = Jpeg::OutputMode::Colour, Allocator& allocator = defaultAllocator());
+    ~MjpegDecoder();
+
+    MjpegDecoder(const MjpegDecoder&) = delete;
+    MjpegDecoder& operator=(const MjpegDecoder&) = delete;
+
+    //decodes the frame starting at the SOI at the front of data, returning the
+    //bytes up to and including its EOI
+    size_t decodeFrame(std::span<uint8_t> data);
+
+    //decodes every frame in a buffer of concatenated frames, skipping anything
+    //between them such as multipart boundaries. returns the frames decoded.
+    typedef std::function<void(const Jpeg& frame, size_t frameIndex)> FrameCallback;
+    size_t decodeStream(std::span<uint8_t> stream, const FrameCallback& onFrame);
+
+    //the last decoded frame. _image or _lumaImage stay owned by the decoder
+    //and are overwritten by the next frame.
+    const Jpeg& frame() const { return _jpeg; }
+
+    size_t _framesDecoded = 0;
+    size_t _frameHeadersReused = 0;
+    size_t _huffmanTablesBuilt = 0;
+
+private:
+    void huffmanTables(std::span<uint8_t> data);
+    void installDefaultHuffmanTables();
+    void startOfFrame(std::span<uint8_t> data);
+    void releaseFrame();
+
+    Jpeg _jpeg;
+
+    //Tc Th, bits and values that each table slot was last built from. DC
+    //slots are 0 to 3, AC slots 4 to 7.
+    std::array<std::vector<uint8_t>, 8> _huffmanSources;
+    std::vector<uint8_t> _frameHeader;
+};
+
+}
+
+#endif /* mjpeg_hpp */
@@ -0,0 +1,242 @@
+//
+//  probe.cpp
+//  libdanpg
+//
+//  Created by Daniel Burke on 19/10/2026.
+//
+
+#include "probe.hpp"
+
+#include <cstring>
+
+using namespace image;
+
+namespace {
+
+//position of the marker ending the entropy data starting at position
+size_t skipEntropyData(std::span<const uint8_t> data, size_t position) {
+    while (position < data.size()) {
+        auto found = static_cast<const uint8_t*>(std::memchr(&data[position], 0xff, data.size() - position));
+        if (!found) {
+            return data.size();
+        }
+        
+        position = found - data.data();
+        if (position + 1 >= data.size()) {
+            return data.size();
+        }
+        
+        uint8_t next = data[position + 1];
+        if (next == 0x00 || (next >= 0xd0 && next <= 0xd7)) {
+            //stuffed byte or restart marker, still in the scan
+            position += 2;
+        } else if (next == 0xff) {
+            //fill bytes before a marker
+            position++;
+        } else {
+            return position;
+        }
+    }
+    
+    return data.size();
+}
+
+//bounds checked reads from Exif TIFF data in either byte order
+struct TiffReader {
+    std::span<const uint8_t> _tiff;
+    bool _bigEndian = false;
+    
+    bool read16(size_t offset, uint16_t& value) const {
+        if (offset + 2 > _tiff.size()) {
+            return false;
+        }
+        auto bytes = &_tiff[offset];
+        value = _bigEndian ? (bytes[0] << 8) | bytes[1] : (bytes[1] << 8) | bytes[0];
+        return true;
+    }
+    
+    bool read32(size_t offset, uint32_t& value) const {
+        uint16_t first, second;
+        if (!read16(offset, first) || !read16(offset + 2, second)) {
+            return false;
+        }
+        value = _bigEndian ? (uint32_t(first) << 16) | second : (uint32_t(second) << 16) | first;
+        return true;
+    }
+};
+
+const char* readFrame(JpegInfo& info, uint8_t marker, std::span<const uint8_t> segment) {
+    if (segment.size() < 6) {
+        return "frame header truncated";
+    }
+    
+    info._sofMarker = marker;
+    info._baseline = marker == 0xc0;
+    info._progressive = marker == 0xc2 || marker == 0xc6 || marker == 0xca || marker == 0xce;
+    info._precision = segment[0];
+    info._height = readBigEndian16(&segment[1]);
+    info._width = readBigEndian16(&segment[3]);
+    
+    uint8_t nf = segment[5];
+    if (nf > info._components.size()) {
+        return "too many frame components";
+    }
+    if (segment.size() < 6 + size_t(nf) * 3) {
+        return "frame components truncated";
+    }
+    
+    info._componentCount = nf;
+    for (size_t i = 0; i < nf; i++) {
+        auto component = &segment[6 + i * 3];
+        info._components[i] = {component[0], static_cast<uint8_t>(component[1] >> 4), static_cast<uint8_t>(component[1] & 0x0f), component[2]};
+    }
+    
+    return nullptr;
+}
+
+}
+
+JpegInfo image::probe(std::span<const uint8_t> data, bool walkPastScans) {
+    JpegInfo info;
+    
+    if (data.size() < 2 || data[0] != 0xff || data[1] != 0xd8) {
+        info._error = "missing start of image";
+        return info;
+    }
+    
+    size_t position = 2;
+    while (position + 1 < data.size()) {
+        if (data[position] != 0xff) {
+            info._error = "expected a marker";
+            return info;
+        }
+        
+        uint8_t marker = data[position + 1];
+        if (marker == 0xff) {
+            position++;
+            continue;
+        }
+        
+        if (marker == 0xd9) {
+            break;
+        }
+        
+        if (marker == 0x01 || (marker >= 0xd0 && marker <= 0xd7)) {
+            //standalone markers have no length
+            position += 2;
+            continue;
+        }
+        
+        if (position + 4 > data.size()) {
+            info._error = "marker segment truncated";
+            return info;
+        }
+        
+        size_t length = readBigEndian16(&data[position + 2]);
+        if (length < 2 || position + 2 + length > data.size()) {
+            info._error = "marker segment truncated";
+            return info;
+        }
+        
+        auto segment = data.subspan(position + 4, length - 2);
+        size_t segmentEnd = position + 2 + length;
+        
+        if (isFrameMarker(marker)) {
+            if ((info._error = readFrame(info, marker, segment))) {
+                return info;
+            }
+        } else if (marker == 0xdd) {
+            if (segment.size() != 2) {
+                info._error = "restart interval length is wrong";
+                return info;
+            }
+            info._restartInterval = readBigEndian16(&segment[0]);
+        } else if (marker == 0xe1 && !info._exifLength && segment.size() >= 6 && std::memcmp(segment.data(), "Exif\0\0", 6) == 0) {
+            info._exifOffset = position + 4 + 6;
+            info._exifLength = segment.size() - 6;
+        } else if (marker == 0xda) {
+            if (!info._sofMarker) {
+                info._error = "scan before frame header";
+                return info;
+            }
+            
+            info._scans++;
+            if (!info._scanOffset) {
+                info._scanOffset = segmentEnd;
+            }
+            
+            if (!walkPastScans) {
+                return info;
+            }
+            
+            position = skipEntropyData(data, segmentEnd);
+            continue;
+        }
+        
+        position = segmentEnd;
+    }
+    
+    if (!info._sofMarker) {
+        info._error = "no frame header";
+    }
+    
+    return info;
+}
+
+std::span<const uint8_t> image::exifThumbnail(std::span<const uint8_t> data, const JpegInfo& info) {
+    if (!info._exifLength || info._exifOffset + info._exifLength > data.size()) {
+        return {};
+    }
+    
+    TiffReader reader{data.subspan(info._exifOffset, info._exifLength)};
+    if (reader._tiff.size() < 8) {
+        return {};
+    }
+    
+    if (reader._tiff[0] == 'M' && reader._tiff[1] == 'M') {
+        reader._bigEndian = true;
+    } else if (reader._tiff[0] != 'I' || reader._tiff[1] != 'I') {
+        return {};
+    }
+    
+    //IFD0 describes the main image, the thumbnail is in the IFD after it
+    uint16_t magic, ifd0Entries, ifd1Entries;
+    uint32_t ifd0, ifd1;
+    if (!reader.read16(2, magic) || magic != 42 ||
+        !reader.read32(4, ifd0) || !reader.read16(ifd0, ifd0Entries) ||
+        !reader.read32(size_t(ifd0) + 2 + ifd0Entries * 12, ifd1) || !ifd1 ||
+        !reader.read16(ifd1, ifd1Entries)) {
+        return {};
+    }
+    
+    uint16_t compression = 6; //old style jpeg, assumed when not given
+    uint32_t offset = 0;
+    uint32_t length = 0;
+    for (size_t i = 0; i < ifd1Entries; i++) {
+        size_t entry = size_t(ifd1) + 2 + i * 12;
+        uint16_t tag;
+        if (!reader.read16(entry, tag)) {
+            return {};
+        }
+        
+        //values that fit are stored in the entry itself
+        if (tag == 0x0103) {
+            reader.read16(entry + 8, compression);
+        } else if (tag == 0x0201) {
+            reader.read32(entry + 8, offset);
+        } else if (tag == 0x0202) {
+            reader.read32(entry + 8, length);
+        }
+    }
+    
+    if (compression != 6 || length < 2 || size_t(offset) + length > reader._tiff.size()) {
+        return {};
+    }
+    
+    auto thumbnail = reader._tiff.subspan(offset, length);
+    if (thumbnail[0] != 0xff || thumbnail[1] != 0xd8) {
+        return {};
+    }
+    
+    return thumbnail;
+}
@@ -0,0 +1,68 @@
+//
+//  probe.hpp
+//  libdanpg
+//
+//  Created by Daniel Burke on 19/10/2026.
+//
+
+#ifndef probe_hpp
+#define probe_hpp
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+namespace image {
+
+struct JpegInfo {
+    uint16_t _width = 0;
+    uint16_t _height = 0;
+    uint8_t _precision = 0;
+    uint8_t _sofMarker = 0; //0 until a frame header is seen
+    bool _baseline = false;
+    bool _progressive = false;
+    uint16_t _restartInterval = 0;
+    
+    struct Component {
+        uint8_t _c; //component identifier
+        uint8_t _h; //horizontal sampling factor
+        uint8_t _v; //vertical sampling factor
+        uint8_t _tq; //quantization table destination selector
+    };
+    uint8_t _componentCount = 0;
+    std::array<Component, 4> _components{};
+    
+    size_t _scanOffset = 0; //first byte of entropy coded data in the first scan
+    size_t _scans = 0;
+    size_t _exifOffset = 0; //APP1 Exif payload, after the "Exif\0\0" header
+    size_t _exifLength = 0;
+    
+    //static string, set when the header is malformed or truncated
+    const char* _error = nullptr;
+    
+    bool valid() const { return _error == nullptr; }
+};
+
+//marker segment lengths and frame header fields are big endian
+inline uint16_t readBigEndian16(const uint8_t* data) {
+    return static_cast<uint16_t>((data[0] << 8) | data[1]);
+}
+
+inline bool isFrameMarker(uint8_t marker) {
+    //SOF0 to SOF15 except DHT, JPG and DAC which share the range
+    return marker >= 0xc0 && marker <= 0xcf && marker != 0xc4 && marker != 0xc8 && marker != 0xcc;
+}
+
+//walks the marker segments without decoding or allocating anything. stops at
+//the first SOS unless walkPastScans, which skips entropy data with memchr to
+//reach the segments between and after scans.
+JpegInfo probe(std::span<const uint8_t> data, bool walkPastScans = false);
+
+//the jpeg thumbnail that IFD1 of the Exif data points at, empty when there
+//isn't one or the TIFF structure doesn't hold together
+std::span<const uint8_t> exifThumbnail(std::span<const uint8_t> data, const JpegInfo& info);
+
+}
+
+#endif /* probe_hpp */
@@ -0,0 +1,89 @@
+//
+//  ringbuffer.hpp
+//  libdanpg
+//
+//  Created by Daniel Burke on 19/10/2026.
+//
+
+#ifndef ringbuffer_hpp
+#define ringbuffer_hpp
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+
+namespace image {
+
+//bounded lock-free queue, safe for any number of producers and consumers.
+//each slot carries a sequence number that says whether it is ready to be
+//written or read for the current lap around the buffer.
+template<typename T, size_t Capacity>
+class RingBuffer {
+    static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0, "capacity must be a power of two");
+
+private:
+    struct Slot {
+        std::atomic<size_t> _sequence;
+        T _value;
+    };
+
+    std::array<Slot, Capacity> _slots;
+    alignas(64) std::atomic<size_t> _pushPosition = 0;
+    alignas(64) std::atomic<size_t> _popPosition = 0;
+
+public:
+    RingBuffer() {
+        for (size_t i = 0; i < Capacity; i++) {
+            _slots[i]._sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    RingBuffer(const RingBuffer&) = delete;
+    RingBuffer& operator=(const RingBuffer&) = delete;
+
+    bool tryPush(const T& value) {
+        size_t position = _pushPosition.load(std::memory_order_relaxed);
+        for (;;) {
+            Slot& slot = _slots[position & (Capacity - 1)];
+            size_t sequence = slot._sequence.load(std::memory_order_acquire);
+
+            if (sequence == position) {
+                if (_pushPosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    slot._value = value;
+                    slot._sequence.store(position + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (sequence < position) {
+                //slot still holds a value from the previous lap, full
+                return false;
+            } else {
+                position = _pushPosition.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    bool tryPop(T& value) {
+        size_t position = _popPosition.load(std::memory_order_relaxed);
+        for (;;) {
+            Slot& slot = _slots[position & (Capacity - 1)];
+            size_t sequence = slot._sequence.load(std::memory_order_acquire);
+
+            if (sequence == position + 1) {
+                if (_popPosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    value = slot._value;
+                    slot._sequence.store(position + Capacity, std::memory_order_release);
+                    return true;
+                }
+            } else if (sequence < position + 1) {
+                //nothing published into this slot yet, empty
+                return false;
+            } else {
+                position = _popPosition.load(std::memory_order_relaxed);
+            }
+        }
+    }
+};
+
+}
+
+#endif /* ringbuffer_hpp */
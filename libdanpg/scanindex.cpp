@@ -0,0 +1,162 @@
+//
+//  scanindex.cpp
+//  libdanpg
+//
+//  Created by Daniel Burke on 19/10/2026.
+//
+
+#include "scanindex.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+
+using namespace image;
+
+namespace {
+
+//"DPGI" then a version byte, everything after is LEB128 varints apart from the hash
+const std::array<uint8_t, 5> indexMagic = {'D', 'P', 'G', 'I', 1};
+
+void writeVarint(std::vector<uint8_t>& out, uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back(static_cast<uint8_t>(value) | 0x80);
+        value >>= 7;
+    }
+    out.push_back(static_cast<uint8_t>(value));
+}
+
+//zigzag, so small negative predictors stay one byte
+void writeSignedVarint(std::vector<uint8_t>& out, int64_t value) {
+    writeVarint(out, (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63));
+}
+
+struct BlobReader {
+    std::span<const uint8_t> _blob;
+    size_t _position = 0;
+
+    uint8_t byte() {
+        if (_position >= _blob.size()) {
+            throw std::runtime_error("scan index is truncated");
+        }
+        return _blob[_position++];
+    }
+
+    uint64_t varint() {
+        uint64_t value = 0;
+        for (unsigned int shift = 0; shift < 64; shift += 7) {
+            uint8_t next = byte();
+            value |= static_cast<uint64_t>(next & 0x7F) << shift;
+            if (!(next & 0x80)) {
+                return value;
+            }
+        }
+        throw std::runtime_error("scan index varint is too long");
+    }
+
+    int64_t signedVarint() {
+        uint64_t value = varint();
+        return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+    }
+};
+
+}
+
+uint64_t ScanIndex::hashHeaders(std::span<const uint8_t> data, size_t scanOffset) {
+    uint64_t hash = 0xcbf29ce484222325;
+    for (auto byte : data.first(std::min(scanOffset, data.size()))) {
+        hash = (hash ^ byte) * 0x100000001b3;
+    }
+    return hash;
+}
+
+std::vector<uint8_t> ScanIndex::serialise() const {
+    std::vector<uint8_t> blob(indexMagic.begin(), indexMagic.end());
+    writeVarint(blob, _dataBytes);
+    writeVarint(blob, _scanOffset);
+    for (size_t i = 0; i < 8; i++) {
+        blob.push_back(static_cast<uint8_t>(_headerHash >> (i * 8)));
+    }
+    writeVarint(blob, _components);
+    writeVarint(blob, _rowsPerEntry);
+    writeVarint(blob, _entries.size());
+
+    //rows and offsets only go forward, so store the steps between entries
+    size_t previousRow = 0;
+    size_t previousByte = 0;
+    for (auto& entry : _entries) {
+        writeVarint(blob, entry._mcuRow - previousRow);
+        writeVarint(blob, entry._position._byte - previousByte);
+        blob.push_back(entry._position._bit);
+        for (size_t i = 0; i < _components; i++) {
+            writeSignedVarint(blob, entry._prevDC[i]);
+        }
+
+        previousRow = entry._mcuRow;
+        previousByte = entry._position._byte;
+    }
+
+    return blob;
+}
+
+ScanIndex ScanIndex::deserialise(std::span<const uint8_t> blob) {
+    BlobReader reader{blob};
+    for (auto expected : indexMagic) {
+        if (reader.byte() != expected) {
+            throw std::runtime_error("not a scan index, or a different version");
+        }
+    }
+
+    ScanIndex index;
+    index._dataBytes = reader.varint();
+    index._scanOffset = reader.varint();
+    for (size_t i = 0; i < 8; i++) {
+        index._headerHash |= static_cast<uint64_t>(reader.byte()) << (i * 8);
+    }
+    index._components = reader.varint();
+    index._rowsPerEntry = reader.varint();
+    if (index._components == 0 || index._components > 4) {
+        throw std::runtime_error("scan index component count is wrong");
+    }
+
+    size_t entries = reader.varint();
+    size_t row = 0;
+    size_t byte = 0;
+    for (size_t i = 0; i < entries; i++) {
+        Entry entry{};
+        row += reader.varint();
+        byte += reader.varint();
+        entry._mcuRow = row;
+        entry._position = {byte, reader.byte()};
+        if (entry._position._bit > 7) {
+            throw std::runtime_error("scan index bit offset is wrong");
+        }
+
+        for (size_t component = 0; component < index._components; component++) {
+            entry._prevDC[component] = static_cast<int>(reader.signedVarint());
+        }
+        index._entries.push_back(entry);
+    }
+
+    return index;
+}
+
+void ScanIndex::save(const std::string& path) const {
+    auto blob = serialise();
+    std::ofstream file(path, std::ios::binary);
+    file.write(reinterpret_cast<const char*>(blob.data()), blob.size());
+    if (!file) {
+        throw std::runtime_error("couldn't write scan index to " + path);
+    }
+}
+
+ScanIndex ScanIndex::load(const std::string& path) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        throw std::runtime_error("couldn't open scan index " + path);
+    }
+
+    std::vector<uint8_t> blob((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    return deserialise(blob);
+}
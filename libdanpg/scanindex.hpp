@@ -0,0 +1,55 @@
+//
+//  scanindex.hpp
+//  libdanpg
+//
+//  Created by Daniel Burke on 19/10/2026.
+//
+
+#ifndef scanindex_hpp
+#define scanindex_hpp
+
+#include <array>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "huffmantable.hpp"
+
+namespace image {
+
+//where the entropy decoder was at the start of every _rowsPerEntry MCU rows of
+//a scan, like zran does for gzip. decoding can start at any entry instead of
+//the top of the scan, without needing restart markers. LazyJpeg builds them
+//and starts from them, and they serialise to a few bytes an entry to keep
+//next to the image.
+struct ScanIndex {
+    struct Entry {
+        size_t _mcuRow;
+        BitDecoder::BitPosition _position; //from the start of the scan data
+        std::array<int, 4> _prevDC; //per component, in scan order
+    };
+
+    //what the index was built from, so it isn't used on a different image
+    size_t _dataBytes = 0;
+    size_t _scanOffset = 0;
+    uint64_t _headerHash = 0;
+    size_t _components = 0;
+
+    size_t _rowsPerEntry = 0;
+    std::vector<Entry> _entries;
+
+    //FNV-1a over everything before the scan data
+    static uint64_t hashHeaders(std::span<const uint8_t> data, size_t scanOffset);
+
+    std::vector<uint8_t> serialise() const;
+    //throws std::runtime_error for anything that isn't a whole index
+    static ScanIndex deserialise(std::span<const uint8_t> blob);
+
+    void save(const std::string& path) const;
+    static ScanIndex load(const std::string& path);
+};
+
+}
+
+#endif /* scanindex_hpp */
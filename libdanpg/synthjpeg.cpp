@@ -0,0 +1,372 @@
+//
+//  synthjpeg.cpp
+//  libdanpg
+//
+//  Created by Daniel Burke on 19/10/2026.
+//
+
+#include "synthjpeg.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdlib>
+#include <memory>
+#include <numbers>
+#include <stdexcept>
+
+#include "huffmantable.hpp"
+#include "mjpeg.hpp"
+
+using namespace image;
+
+namespace {
+
+const std::array<uint8_t, 64> zigzagToNatural = {
+    0,   1,  8, 16,  9,  2,  3, 10,
+    17, 24, 32, 25, 18, 11,  4,  5,
+    12, 19, 26, 33, 40, 48, 41, 34,
+    27, 20, 13,  6,  7, 14, 21, 28,
+    35, 42, 49, 56, 57, 50, 43, 36,
+    29, 22, 15, 23, 30, 37, 44, 51,
+    58, 59, 52, 45, 38, 31, 39, 46,
+    53, 60, 61, 54, 47, 55, 62, 63,
+};
+
+//Annex K.1, natural order
+const std::array<uint8_t, 64> luminanceQuantisation = {
+    16, 11, 10, 16,  24,  40,  51,  61,
+    12, 12, 14, 19,  26,  58,  60,  55,
+    14, 13, 16, 24,  40,  57,  69,  56,
+    14, 17, 22, 29,  51,  87,  80,  62,
+    18, 22, 37, 56,  68, 109, 103,  77,
+    24, 35, 55, 64,  81, 104, 113,  92,
+    49, 64, 78, 87, 103, 121, 120, 101,
+    72, 92, 95, 98, 112, 100, 103,  99,
+};
+
+const std::array<uint8_t, 64> chrominanceQuantisation = {
+    17, 18, 24, 47, 99, 99, 99, 99,
+    18, 21, 26, 66, 99, 99, 99, 99,
+    24, 26, 56, 99, 99, 99, 99, 99,
+    47, 66, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99,
+};
+
+std::array<uint8_t, 64> scaledQuantisation(const std::array<uint8_t, 64>& base, int quality) {
+    //libjpeg's jpeg_quality_scaling
+    int scale = quality < 50 ? 5000 / quality : 200 - quality * 2;
+    std::array<uint8_t, 64> scaled;
+    for (size_t i = 0; i < scaled.size(); i++) {
+        scaled[i] = static_cast<uint8_t>(std::clamp((base[i] * scale + 50) / 100, 1, 255));
+    }
+    return scaled;
+}
+
+//EHUFCO and EHUFSI of C.2, by symbol
+struct HuffmanCodes {
+    std::array<uint16_t, 256> _code{};
+    std::array<uint8_t, 256> _size{};
+};
+
+HuffmanCodes huffmanCodes(const std::vector<uint8_t>& definition) {
+    std::vector<uint8_t> tableDef(definition.begin() + 1, definition.end());
+    auto table = std::make_unique<HuffmanTable>(HuffmanTable::build(tableDef));
+
+    HuffmanCodes codes;
+    for (size_t i = 0; i < table->_huffval.size(); i++) {
+        codes._code[table->_huffval[i]] = table->_huffcode[i];
+        codes._size[table->_huffval[i]] = table->_huffsize[i];
+    }
+    return codes;
+}
+
+class BitWriter {
+public:
+    explicit BitWriter(std::vector<uint8_t>& out) : _out(out) {}
+
+    void write(uint32_t bits, size_t count) {
+        _buffer = (_buffer << count) | (bits & ((1u << count) - 1));
+        _count += count;
+        while (_count >= 8) {
+            uint8_t byte = static_cast<uint8_t>(_buffer >> (_count - 8));
+            _out.push_back(byte);
+            if (byte == 0xFF) {
+                //F.1.2.3
+                _out.push_back(0x00);
+            }
+            _count -= 8;
+        }
+    }
+
+    //pads the last byte with ones, F.1.2.3
+    void flush() {
+        if (_count) {
+            write(0x7F, 8 - _count);
+        }
+    }
+
+private:
+    std::vector<uint8_t>& _out;
+    uint64_t _buffer = 0;
+    size_t _count = 0;
+};
+
+//SSSS of F.1.2.1 and the bits that follow it, negative values one less
+size_t magnitudeCategory(int value) {
+    size_t ssss = 0;
+    for (unsigned int magnitude = std::abs(value); magnitude; magnitude >>= 1) {
+        ssss++;
+    }
+    return ssss;
+}
+
+void writeValue(BitWriter& writer, int value, size_t ssss) {
+    writer.write(value < 0 ? value + (1 << ssss) - 1 : value, ssss);
+}
+
+void encodeBlock(BitWriter& writer, const std::array<int, 64>& zigzagged, int& prevDC, const HuffmanCodes& dc, const HuffmanCodes& ac) {
+    //F.1.2.1
+    int diff = zigzagged[0] - prevDC;
+    prevDC = zigzagged[0];
+    size_t ssss = magnitudeCategory(diff);
+    writer.write(dc._code[ssss], dc._size[ssss]);
+    writeValue(writer, diff, ssss);
+
+    //F.1.2.2
+    size_t run = 0;
+    for (size_t k = 1; k < 64; k++) {
+        if (zigzagged[k] == 0) {
+            run++;
+            continue;
+        }
+
+        for (; run > 15; run -= 16) {
+            writer.write(ac._code[0xF0], ac._size[0xF0]);
+        }
+        ssss = magnitudeCategory(zigzagged[k]);
+        uint8_t rs = static_cast<uint8_t>((run << 4) | ssss);
+        writer.write(ac._code[rs], ac._size[rs]);
+        writeValue(writer, zigzagged[k], ssss);
+        run = 0;
+    }
+
+    if (run) {
+        writer.write(ac._code[0x00], ac._size[0x00]);
+    }
+}
+
+//even over [-1, 1] for every position, seed and channel
+float noise(size_t x, size_t y, uint32_t seed, uint32_t channel) {
+    uint32_t h = static_cast<uint32_t>(x) * 0x9E3779B1u ^ static_cast<uint32_t>(y) * 0x85EBCA77u ^ seed * 0xC2B2AE3Du ^ channel * 0x27D4EB2Fu;
+    h ^= h >> 16;
+    h *= 0x7FEB352Du;
+    h ^= h >> 15;
+    h *= 0x846CA68Bu;
+    h ^= h >> 16;
+    return static_cast<float>(h) / 2147483647.5f - 1.0f;
+}
+
+//the picture, built from tables along each axis so a sample is a few
+//multiplies. periods are in pixels rather than fractions of the image so a
+//bigger image has more detail, not blurrier detail.
+struct Picture {
+    std::vector<float> _waveX, _waveY;
+    std::vector<float> _rampX, _rampY;
+    //where the texture is, zero over some stretches to leave flat blocks
+    std::vector<float> _textureX, _textureY;
+    uint32_t _seed;
+
+    Picture(size_t width, size_t height, uint32_t seed) : _seed(seed) {
+        const float phase = static_cast<float>(seed % 1000) * 0.01f;
+        auto axis = [&](size_t length, float wavePeriod, float texturePeriod, std::vector<float>& wave, std::vector<float>& ramp, std::vector<float>& texture) {
+            wave.resize(length);
+            ramp.resize(length);
+            texture.resize(length);
+            for (size_t i = 0; i < length; i++) {
+                wave[i] = std::sin(2 * std::numbers::pi_v<float> * i / wavePeriod + phase);
+                ramp[i] = static_cast<float>(i) / length - 0.5f;
+                texture[i] = std::max(0.0f, std::sin(2 * std::numbers::pi_v<float> * i / texturePeriod + phase) + 0.6f);
+            }
+        };
+        axis(width, 97.0f, 331.0f, _waveX, _rampX, _textureX);
+        axis(height, 61.0f, 257.0f, _waveY, _rampY, _textureY);
+    }
+
+    //channel 0 is Y, 1 Cb and 2 Cr
+    uint8_t sample(size_t x, size_t y, uint32_t channel) const {
+        static const std::array<float, 3> base = {128.0f, 118.0f, 138.0f};
+        static const std::array<float, 3> wave = {45.0f, 20.0f, 16.0f};
+        static const std::array<float, 3> ramp = {60.0f, 40.0f, -40.0f};
+        static const std::array<float, 3> texture = {28.0f, 8.0f, 8.0f};
+
+        float value = base[channel] + wave[channel] * _waveX[x] * _waveY[y] + ramp[channel] * (channel == 2 ? _rampY[y] : _rampX[x]) +
+                      texture[channel] * _textureX[x] * _textureY[y] * noise(x, y, _seed, channel);
+        return static_cast<uint8_t>(std::clamp(std::lround(value), 0l, 255l));
+    }
+};
+
+//the orthonormal forward DCT of A.3.3, level shifted, quantised and reordered
+class ForwardDCT {
+public:
+    ForwardDCT() {
+        for (size_t u = 0; u < 8; u++) {
+            float scale = u == 0 ? std::numbers::sqrt2_v<float> / 4 : 0.5f;
+            for (size_t x = 0; x < 8; x++) {
+                _cosines[u * 8 + x] = scale * std::cos((2 * x + 1) * u * std::numbers::pi_v<float> / 16);
+            }
+        }
+    }
+
+    std::array<int, 64> transform(const std::array<uint8_t, 64>& samples, const std::array<uint8_t, 64>& quantisation) const {
+        std::array<float, 64> rows;
+        for (size_t y = 0; y < 8; y++) {
+            for (size_t u = 0; u < 8; u++) {
+                float sum = 0;
+                for (size_t x = 0; x < 8; x++) {
+                    sum += _cosines[u * 8 + x] * (static_cast<float>(samples[y * 8 + x]) - 128.0f);
+                }
+                rows[y * 8 + u] = sum;
+            }
+        }
+
+        std::array<int, 64> zigzagged;
+        for (size_t k = 0; k < 64; k++) {
+            size_t natural = zigzagToNatural[k];
+            size_t u = natural % 8;
+            size_t v = natural / 8;
+            float sum = 0;
+            for (size_t y = 0; y < 8; y++) {
+                sum += _cosines[v * 8 + y] * rows[y * 8 + u];
+            }
+            //ac magnitudes have at most 10 bits in baseline, F.1.2.2
+            zigzagged[k] = std::clamp(static_cast<int>(std::lround(sum / quantisation[natural])), -1023, 1023);
+        }
+        return zigzagged;
+    }
+
+private:
+    std::array<float, 64> _cosines;
+};
+
+void putSegmentHeader(std::vector<uint8_t>& out, uint8_t marker, size_t length) {
+    out.insert(out.end(), {0xFF, marker, static_cast<uint8_t>(length >> 8), static_cast<uint8_t>(length)});
+}
+
+}
+
+std::vector<uint8_t> SyntheticJpeg::encode() const {
+    if (_width == 0 || _height == 0 || _width > 0xFFFF || _height > 0xFFFF) {
+        throw std::logic_error("jpeg dimensions are 1 to 65535");
+    }
+    if (_quality < 1 || _quality > 100) {
+        throw std::logic_error("quality is 1 to 100");
+    }
+    if (!_greyscale && (_h < 1 || _v < 1 || _h > 4 || _v > 4 || _h * _v + 2 > 10)) {
+        //B.2.3, no more than ten blocks in an MCU
+        throw std::logic_error("sampling factors don't fit a baseline MCU");
+    }
+
+    const size_t components = _greyscale ? 1 : 3;
+    const uint8_t h = _greyscale ? 1 : _h;
+    const uint8_t v = _greyscale ? 1 : _v;
+    const std::array<std::array<uint8_t, 64>, 2> quantisation = {
+        scaledQuantisation(luminanceQuantisation, _quality), scaledQuantisation(chrominanceQuantisation, _quality)
+    };
+
+    std::vector<uint8_t> out = {0xFF, 0xD8};
+
+    putSegmentHeader(out, 0xDB, 2 + 65 * (components == 1 ? 1 : 2));
+    for (uint8_t table = 0; table < (components == 1 ? 1 : 2); table++) {
+        out.push_back(table);
+        for (size_t k = 0; k < 64; k++) {
+            out.push_back(quantisation[table][zigzagToNatural[k]]);
+        }
+    }
+
+    putSegmentHeader(out, 0xC0, 8 + 3 * components);
+    out.insert(out.end(), {0x08, static_cast<uint8_t>(_height >> 8), static_cast<uint8_t>(_height), static_cast<uint8_t>(_width >> 8), static_cast<uint8_t>(_width), static_cast<uint8_t>(components)});
+    for (uint8_t c = 0; c < components; c++) {
+        out.insert(out.end(), {static_cast<uint8_t>(c + 1), static_cast<uint8_t>(c == 0 ? (h << 4) | v : 0x11), static_cast<uint8_t>(c == 0 ? 0 : 1)});
+    }
+
+    std::vector<const std::vector<uint8_t>*> tables = {&defaultDCLuminance, &defaultACLuminance};
+    if (components == 3) {
+        tables.insert(tables.end(), {&defaultDCChrominance, &defaultACChrominance});
+    }
+    for (auto* table : tables) {
+        putSegmentHeader(out, 0xC4, 2 + table->size());
+        out.insert(out.end(), table->begin(), table->end());
+    }
+
+    if (_restartInterval) {
+        putSegmentHeader(out, 0xDD, 4);
+        out.insert(out.end(), {static_cast<uint8_t>(_restartInterval >> 8), static_cast<uint8_t>(_restartInterval)});
+    }
+
+    putSegmentHeader(out, 0xDA, 6 + 2 * components);
+    out.push_back(static_cast<uint8_t>(components));
+    for (uint8_t c = 0; c < components; c++) {
+        out.insert(out.end(), {static_cast<uint8_t>(c + 1), static_cast<uint8_t>(c == 0 ? 0x00 : 0x11)});
+    }
+    out.insert(out.end(), {0x00, 0x3F, 0x00});
+
+    const std::array<HuffmanCodes, 2> dcCodes = {huffmanCodes(defaultDCLuminance), huffmanCodes(defaultDCChrominance)};
+    const std::array<HuffmanCodes, 2> acCodes = {huffmanCodes(defaultACLuminance), huffmanCodes(defaultACChrominance)};
+    const Picture picture(_width, _height, _seed);
+    const ForwardDCT fdct;
+
+    //A.2.2 and A.2.3, a single component scan has one block per MCU
+    const size_t mcuWidth = 8 * h;
+    const size_t mcuHeight = 8 * v;
+    const size_t mcusPerLine = (_width + mcuWidth - 1) / mcuWidth;
+    const size_t mcuLines = (_height + mcuHeight - 1) / mcuHeight;
+
+    BitWriter writer(out);
+    std::array<int, 3> prevDC = {};
+    size_t mcusInInterval = 0;
+    uint8_t nextRestart = 0;
+    for (size_t mcuY = 0; mcuY < mcuLines; mcuY++) {
+        for (size_t mcuX = 0; mcuX < mcusPerLine; mcuX++) {
+            if (_restartInterval && mcusInInterval == _restartInterval) {
+                writer.flush();
+                out.insert(out.end(), {0xFF, static_cast<uint8_t>(0xD0 + nextRestart)});
+                nextRestart = (nextRestart + 1) % 8;
+                prevDC = {};
+                mcusInInterval = 0;
+            }
+
+            for (size_t c = 0; c < components; c++) {
+                //chroma samples cover h x v pixels, taken from the top left one
+                size_t blocksAcross = c == 0 ? h : 1;
+                size_t blocksDown = c == 0 ? v : 1;
+                size_t xStep = c == 0 ? 1 : h;
+                size_t yStep = c == 0 ? 1 : v;
+                for (size_t blockY = 0; blockY < blocksDown; blockY++) {
+                    for (size_t blockX = 0; blockX < blocksAcross; blockX++) {
+                        std::array<uint8_t, 64> samples;
+                        for (size_t y = 0; y < 8; y++) {
+                            //past the edge repeats the last row and column, as encoders pad
+                            size_t imageY = std::min((mcuY * blocksDown + blockY) * 8 * yStep + y * yStep, _height - 1);
+                            for (size_t x = 0; x < 8; x++) {
+                                size_t imageX = std::min((mcuX * blocksAcross + blockX) * 8 * xStep + x * xStep, _width - 1);
+                                samples[y * 8 + x] = picture.sample(imageX, imageY, static_cast<uint32_t>(c));
+                            }
+                        }
+
+                        size_t table = c == 0 ? 0 : 1;
+                        encodeBlock(writer, fdct.transform(samples, quantisation[table]), prevDC[c], dcCodes[table], acCodes[table]);
+                    }
+                }
+            }
+            mcusInInterval++;
+        }
+    }
+
+    writer.flush();
+    out.insert(out.end(), {0xFF, 0xD9});
+    return out;
+}
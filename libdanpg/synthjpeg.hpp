@@ -0,0 +1,42 @@
+//
+//  synthjpeg.hpp
+//  libdanpg
+//
+//  Created by Daniel Burke on 19/10/2026.
+//
+
+#ifndef synthjpeg_hpp
+#define synthjpeg_hpp
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace image {
+
+//a baseline jpeg made up on the spot, for benchmarks and tests that need sizes
+//and layouts there are no files for. the picture is smooth gradients with a
+//noisy texture that comes and goes across it, so the entropy data has both
+//busy and near empty blocks like a photo. the same settings always give the
+//same bytes.
+struct SyntheticJpeg {
+    size_t _width = 640;
+    size_t _height = 480;
+    //luma sampling factors, chroma is always 1x1. 1x1 is 4:4:4, 2x1 4:2:2
+    //and 2x2 4:2:0
+    uint8_t _h = 2;
+    uint8_t _v = 2;
+    bool _greyscale = false;
+    //1 to 100, scaling the Annex K quantisation tables as libjpeg does
+    int _quality = 75;
+    //MCUs between restart markers, 0 leaves out DRI
+    uint16_t _restartInterval = 0;
+    uint32_t _seed = 1;
+
+    //throws std::logic_error for settings baseline jpeg can't hold
+    std::vector<uint8_t> encode() const;
+};
+
+}
+
+#endif /* synthjpeg_hpp */